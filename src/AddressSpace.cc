@@ -2,8 +2,10 @@
 
 #include "AddressSpace.h"
 
+#include <fcntl.h>
 #include <limits.h>
 #include <linux/kdev_t.h>
+#include <sys/ioctl.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
@@ -14,6 +16,7 @@
 #include "preload/preload_interface.h"
 
 #include "AutoRemoteSyscalls.h"
+#include "kernel_supplement.h"
 #include "log.h"
 #include "RecordSession.h"
 #include "RecordTask.h"
@@ -26,84 +29,171 @@ namespace rr {
 
 /*static*/ const uint8_t AddressSpace::breakpoint_insn;
 
-/**
- * Advance *str to skip leading blank characters.
- */
-static const char* trim_leading_blanks(const char* str) {
-  const char* trimmed = str;
-  while (isblank(*trimmed)) {
-    ++trimmed;
-  }
-  return trimmed;
-}
-
 /**
  * The following helper is used to iterate over a tracee's memory
  * map.
+ *
+ * Processes can have tens of thousands of mappings, so rather than
+ * fgets()/sscanf() per line we read the file in large chunks and parse
+ * each line in place. Apart from the KernelMapping itself (i.e. its
+ * name), nothing is allocated per line.
  */
 class KernelMapIterator {
 public:
-  KernelMapIterator(Task* t) : t(t) {
+  KernelMapIterator(Task* t)
+      : t(t), buf(BUF_SIZE), line_start(0), line_len(0), buf_len(0) {
     char maps_path[PATH_MAX];
     sprintf(maps_path, "/proc/%d/maps", t->tid);
-    ASSERT(t, (maps_file = fopen(maps_path, "r"))) << "Failed to open "
-                                                   << maps_path;
+    maps_fd = ScopedFd(maps_path, O_RDONLY);
+    ASSERT(t, maps_fd.is_open()) << "Failed to open " << maps_path;
     ++*this;
   }
-  ~KernelMapIterator() {
-    if (maps_file) {
-      fclose(maps_file);
-    }
-  }
   // It's very important to keep in mind that btrfs files can have the wrong
   // device number!
   const KernelMapping& current(string* raw_line = nullptr) {
     if (raw_line) {
-      *raw_line = this->raw_line;
+      *raw_line = string(buf.data() + line_start, line_len);
     }
     return km;
   }
-  bool at_end() { return !maps_file; }
+  bool at_end() { return !maps_fd.is_open(); }
   void operator++();
 
 private:
+  // Large enough for a page's worth of lines, which is what the kernel
+  // returns per read(), and any single line.
+  static const size_t BUF_SIZE = 64 * 1024;
+
+  bool next_line();
+
   Task* t;
-  FILE* maps_file;
-  string raw_line;
+  ScopedFd maps_fd;
+  vector<char> buf;
+  // The current line is buf[line_start, line_start + line_len), not
+  // including its newline. The rest of the data read is up to buf_len.
+  size_t line_start;
+  size_t line_len;
+  size_t buf_len;
   KernelMapping km;
 };
 
-void KernelMapIterator::operator++() {
-  char line[PATH_MAX * 2];
-  if (!fgets(line, sizeof(line), maps_file)) {
-    fclose(maps_file);
-    maps_file = nullptr;
-    return;
+bool KernelMapIterator::next_line() {
+  size_t start = line_start + line_len + 1;
+  if (start > buf_len) {
+    // We're at the start, or consumed a final line with no newline.
+    start = buf_len;
+  }
+  while (true) {
+    char* nl = (char*)memchr(buf.data() + start, '\n', buf_len - start);
+    if (nl) {
+      line_start = start;
+      line_len = nl - (buf.data() + start);
+      return true;
+    }
+    // Move the partial line to the front and read more.
+    memmove(buf.data(), buf.data() + start, buf_len - start);
+    buf_len -= start;
+    start = 0;
+    ASSERT(t, buf_len < buf.size()) << "Line in /proc/" << t->tid
+                                    << "/maps too long";
+    ssize_t nread = read(maps_fd, buf.data() + buf_len, buf.size() - buf_len);
+    ASSERT(t, nread >= 0) << "Failed to read /proc/" << t->tid << "/maps";
+    if (nread == 0) {
+      if (buf_len == 0) {
+        return false;
+      }
+      line_start = 0;
+      line_len = buf_len;
+      return true;
+    }
+    buf_len += nread;
+  }
+}
+
+static bool parse_hex(const char** p, const char* end, uint64_t* value) {
+  const char* s = *p;
+  uint64_t v = 0;
+  while (s < end) {
+    char c = *s;
+    int digit;
+    if (c >= '0' && c <= '9') {
+      digit = c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+      digit = c - 'a' + 10;
+    } else if (c >= 'A' && c <= 'F') {
+      digit = c - 'A' + 10;
+    } else {
+      break;
+    }
+    v = (v << 4) | digit;
+    ++s;
   }
+  if (s == *p) {
+    return false;
+  }
+  *value = v;
+  *p = s;
+  return true;
+}
 
-  uint64_t start, end, offset, inode;
-  int dev_major, dev_minor;
-  char flags[32];
-  int chars_scanned;
-  int nparsed = sscanf(line, "%" SCNx64 "-%" SCNx64 " %31s %" SCNx64
-                             " %x:%x %" SCNu64 " %n",
-                       &start, &end, flags, &offset, &dev_major, &dev_minor,
-                       &inode, &chars_scanned);
-  ASSERT(t, 8 /*number of info fields*/ == nparsed ||
-                7 /*num fields if name is blank*/ == nparsed);
+static bool parse_dec(const char** p, const char* end, uint64_t* value) {
+  const char* s = *p;
+  uint64_t v = 0;
+  while (s < end && *s >= '0' && *s <= '9') {
+    v = v * 10 + (*s - '0');
+    ++s;
+  }
+  if (s == *p) {
+    return false;
+  }
+  *value = v;
+  *p = s;
+  return true;
+}
 
-  // trim trailing newline, if any
-  int last_char = strlen(line) - 1;
-  if (line[last_char] == '\n') {
-    line[last_char] = 0;
+static bool skip_char(const char** p, const char* end, char c) {
+  if (*p < end && **p == c) {
+    ++*p;
+    return true;
   }
-  raw_line = line;
+  return false;
+}
+
+static void skip_blanks(const char** p, const char* end) {
+  while (*p < end && isblank(**p)) {
+    ++*p;
+  }
+}
+
+void KernelMapIterator::operator++() {
+  if (!next_line()) {
+    maps_fd.close();
+    return;
+  }
+
+  const char* p = buf.data() + line_start;
+  const char* end = p + line_len;
+  uint64_t start, end_addr, offset, dev_major, dev_minor, inode;
+  const char* flags;
+  bool ok = parse_hex(&p, end, &start) && skip_char(&p, end, '-') &&
+            parse_hex(&p, end, &end_addr) && skip_char(&p, end, ' ');
+  flags = p;
+  while (ok && p < end && *p != ' ') {
+    ++p;
+  }
+  size_t flags_len = p - flags;
+  ok = ok && skip_char(&p, end, ' ') && parse_hex(&p, end, &offset) &&
+       skip_char(&p, end, ' ') && parse_hex(&p, end, &dev_major) &&
+       skip_char(&p, end, ':') && parse_hex(&p, end, &dev_minor) &&
+       skip_char(&p, end, ' ') && parse_dec(&p, end, &inode);
+  ASSERT(t, ok) << "Can't parse /proc/" << t->tid << "/maps line '"
+                << string(buf.data() + line_start, line_len) << "'";
+  skip_blanks(&p, end);
+  string name(p, end - p);
 
-  const char* name = trim_leading_blanks(line + chars_scanned);
 #if defined(__i386__)
   if (start > numeric_limits<uint32_t>::max() ||
-      end > numeric_limits<uint32_t>::max() ||
-      strcmp(name, "[vsyscall]") == 0) {
+      end_addr > numeric_limits<uint32_t>::max() || name == "[vsyscall]") {
     // We manually read the exe link here because
     // this helper is used to set
     // |t->vm()->exe_image()|, so we can't rely on
@@ -116,18 +206,88 @@ void KernelMapIterator::operator++() {
             << " and that's not supported with a 32-bit rr.";
   }
 #endif
-  int prot = (strchr(flags, 'r') ? PROT_READ : 0) |
-             (strchr(flags, 'w') ? PROT_WRITE : 0) |
-             (strchr(flags, 'x') ? PROT_EXEC : 0);
-  int f = (strchr(flags, 'p') ? MAP_PRIVATE : 0) |
-          (strchr(flags, 's') ? MAP_SHARED : 0);
+  int prot = 0;
+  int f = 0;
+  for (size_t i = 0; i < flags_len; ++i) {
+    switch (flags[i]) {
+      case 'r':
+        prot |= PROT_READ;
+        break;
+      case 'w':
+        prot |= PROT_WRITE;
+        break;
+      case 'x':
+        prot |= PROT_EXEC;
+        break;
+      case 'p':
+        f |= MAP_PRIVATE;
+        break;
+      case 's':
+        f |= MAP_SHARED;
+        break;
+    }
+  }
 
-  km = KernelMapping(start, end, name, MKDEV(dev_major, dev_minor), inode, prot,
-                     f, offset);
+  km = KernelMapping(start, end_addr, name, MKDEV(dev_major, dev_minor), inode,
+                     prot, f, offset);
+}
+
+/**
+ * Look up the mapping containing |addr| with the PROCMAP_QUERY ioctl,
+ * which avoids formatting and parsing the whole maps file. Returns false
+ * if the kernel doesn't support it.
+ */
+static bool query_kernel_mapping(Task* t, remote_ptr<void> addr,
+                                 KernelMapping* result) {
+  static bool unsupported = false;
+  if (unsupported) {
+    return false;
+  }
+
+  char maps_path[PATH_MAX];
+  sprintf(maps_path, "/proc/%d/maps", t->tid);
+  ScopedFd fd(maps_path, O_RDONLY);
+  ASSERT(t, fd.is_open()) << "Failed to open " << maps_path;
+
+  char name[PATH_MAX];
+  struct procmap_query q;
+  memset(&q, 0, sizeof(q));
+  q.size = sizeof(q);
+  q.query_addr = addr.as_int();
+  q.vma_name_size = sizeof(name);
+  q.vma_name_addr = (uintptr_t)name;
+  if (ioctl(fd, PROCMAP_QUERY, &q) < 0) {
+    if (errno == ENOENT) {
+      *result = KernelMapping();
+      return true;
+    }
+    // ENOTTY from kernels that predate the ioctl. Anything else (e.g. a
+    // name longer than PATH_MAX) we leave to the slow path.
+    if (errno == ENOTTY || errno == EINVAL) {
+      unsupported = true;
+    }
+    return false;
+  }
+
+  int prot = ((q.vma_flags & PROCMAP_QUERY_VMA_READABLE) ? PROT_READ : 0) |
+             ((q.vma_flags & PROCMAP_QUERY_VMA_WRITABLE) ? PROT_WRITE : 0) |
+             ((q.vma_flags & PROCMAP_QUERY_VMA_EXECUTABLE) ? PROT_EXEC : 0);
+  int flags =
+      (q.vma_flags & PROCMAP_QUERY_VMA_SHARED) ? MAP_SHARED : MAP_PRIVATE;
+  *result = KernelMapping(q.vma_start, q.vma_end,
+                          q.vma_name_size ? string(name) : string(),
+                          MKDEV(q.dev_major, q.dev_minor), q.inode, prot,
+                          flags, q.vma_offset);
+  return true;
 }
 
 KernelMapping AddressSpace::read_kernel_mapping(Task* t,
                                                 remote_ptr<void> addr) {
+  KernelMapping result;
+  if (query_kernel_mapping(t, addr, &result)) {
+    return result;
+  }
+
   MemoryRange range(addr, 1);
   for (KernelMapIterator it(t); !it.at_end(); ++it) {
     const KernelMapping& km = it.current();
@@ -882,6 +1042,7 @@ void AddressSpace::unmap_internal(remote_ptr<void> addr, ssize_t num_bytes) {
     Mapping m = move(mm);
     mem.erase(m.map);
     LOG(debug) << "  erased (" << m.map << ") ...";
+    unwinder.did_unmap(m.recorded_map);
 
     // If the first segment we unmap underflows the unmap
     // region, remap the underflow region.
@@ -1171,6 +1332,7 @@ AddressSpace::AddressSpace(Session* session, const AddressSpace& o,
       monkeypatch_state(o.monkeypatch_state
                             ? new Monkeypatcher(*o.monkeypatch_state)
                             : nullptr),
+      unwinder(o.unwinder),
       traced_syscall_ip_(o.traced_syscall_ip_),
       privileged_traced_syscall_ip_(o.privileged_traced_syscall_ip_),
       syscallbuf_lib_start_(o.syscallbuf_lib_start_),
@@ -1474,17 +1636,18 @@ static dev_t check_device(Task* t, const KernelMapping& km) {
 }
 
 void AddressSpace::populate_address_space(Task* t) {
+  // Take one snapshot rather than reading the maps file once per pass.
+  vector<KernelMapping> kms;
   bool found_proper_stack = false;
   for (KernelMapIterator it(t); !it.at_end(); ++it) {
-    auto& km = it.current();
-    if (km.is_stack()) {
+    kms.push_back(it.current());
+    if (kms.back().is_stack()) {
       found_proper_stack = true;
     }
   }
 
   int found_stacks = 0;
-  for (KernelMapIterator it(t); !it.at_end(); ++it) {
-    auto& km = it.current();
+  for (auto& km : kms) {
     int flags = km.flags();
     remote_ptr<void> start = km.start();
     ASSERT(t, flags & MAP_PRIVATE);
@@ -16,6 +16,7 @@
 
 #include "preload/preload_interface.h"
 
+#include "EhFrameUnwinder.h"
 #include "EmuFs.h"
 #include "HasTaskSet.h"
 #include "kernel_abi.h"
@@ -244,7 +245,99 @@ public:
     const EmuFile::shr_ptr emu_file;
   };
 
-  typedef std::map<MemoryRange, Mapping, MappingComparator> MemoryMap;
+  /**
+   * The mappings of an address space. This is a std::map keyed by
+   * MappingComparator, plus a cache of the last mapping a lookup found.
+   * Lookups tend to come in runs that hit the same mapping (e.g. loops over
+   * the pages of a region, or walking the map with Maps::iterator), and
+   * the cache turns those into O(1) checks instead of tree walks.
+   * The cache is invalidated whenever a mapping is erased; inserting
+   * doesn't invalidate std::map iterators, so needn't invalidate the cache.
+   */
+  class MemoryMap {
+    typedef std::map<MemoryRange, Mapping, MappingComparator> Map;
+
+  public:
+    typedef Map::iterator iterator;
+    typedef Map::const_iterator const_iterator;
+    typedef Map::value_type value_type;
+
+    MemoryMap() : has_last_hit(false) {}
+    MemoryMap(const MemoryMap& other) : map(other.map), has_last_hit(false) {}
+    MemoryMap& operator=(const MemoryMap& other) {
+      map = other.map;
+      has_last_hit = false;
+      return *this;
+    }
+
+    iterator begin() { return map.begin(); }
+    iterator end() { return map.end(); }
+    const_iterator begin() const { return map.begin(); }
+    const_iterator end() const { return map.end(); }
+    size_t size() const { return map.size(); }
+    bool empty() const { return map.empty(); }
+
+    /**
+     * Returns a mapping intersecting |range|, like std::map::find.
+     */
+    iterator find(const MemoryRange& range) {
+      if (has_last_hit && range.start() < range.end() &&
+          last_hit->first.contains(range)) {
+        return last_hit;
+      }
+      return remember(map.find(range));
+    }
+    const_iterator find(const MemoryRange& range) const {
+      return const_cast<MemoryMap*>(this)->find(range);
+    }
+    /**
+     * Returns the first mapping that isn't entirely before |range|.
+     */
+    iterator lower_bound(const MemoryRange& range) {
+      if (has_last_hit) {
+        const MemoryRange& hit = last_hit->first;
+        // All the mappings before |hit| start before it, and end at or
+        // before its start, so |hit| is the answer if it starts at |range|
+        // or intersects it.
+        if (hit.start() == range.start() ||
+            (range.start() < range.end() && hit.start() < range.start() &&
+             range.start() < hit.end())) {
+          return last_hit;
+        }
+      }
+      return remember(map.lower_bound(range));
+    }
+    const_iterator lower_bound(const MemoryRange& range) const {
+      return const_cast<MemoryMap*>(this)->lower_bound(range);
+    }
+
+    std::pair<iterator, bool> insert(const value_type& v) {
+      return map.insert(v);
+    }
+    Mapping& operator[](const MemoryRange& range) { return map[range]; }
+    void erase(const MemoryRange& range) {
+      has_last_hit = false;
+      map.erase(range);
+    }
+    void erase(iterator first, iterator last) {
+      has_last_hit = false;
+      map.erase(first, last);
+    }
+
+  private:
+    iterator remember(iterator it) const {
+      if (it != map.end()) {
+        last_hit = it;
+        has_last_hit = true;
+      }
+      return it;
+    }
+
+    Map map;
+    // Only an optimization, so lookups in a const MemoryMap can update it.
+    mutable iterator last_hit;
+    mutable bool has_last_hit;
+  };
   typedef std::shared_ptr<AddressSpace> shr_ptr;
 
   ~AddressSpace();
@@ -558,6 +651,8 @@ public:
     return *monkeypatch_state;
   }
 
+  EhFrameUnwinder& eh_frame_unwinder() { return unwinder; }
+
   void at_preload_init(Task* t);
 
   /* The address of the syscall instruction from which traced syscalls made by
@@ -880,6 +975,8 @@ private:
   remote_ptr<void> vdso_start_addr;
   // The monkeypatcher that's handling this address space.
   std::unique_ptr<Monkeypatcher> monkeypatch_state;
+  // Unwind data cached for the objects mapped in this address space.
+  EhFrameUnwinder unwinder;
   // The watchpoints set for tasks in this VM.  Watchpoints are
   // programmed per Task, but we track them per address space on
   // behalf of debuggers that assume that model.
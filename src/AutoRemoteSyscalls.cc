@@ -8,6 +8,8 @@
 
 #include "kernel_metadata.h"
 #include "log.h"
+#include "preload/preload_interface.h"
+#include "RecordSession.h"
 #include "ReplaySession.h"
 #include "Session.h"
 #include "Task.h"
@@ -446,6 +448,126 @@ int64_t AutoRemoteSyscalls::infallible_lseek_syscall(int fd, int64_t offset,
   }
 }
 
+/**
+ * Limit the number of syscalls run per resume, so the syscall table fits
+ * comfortably in the stack space maybe_fix_stack_pointer() finds.
+ */
+static const size_t MAX_BATCHED_SYSCALLS = 16;
+
+bool AutoRemoteSyscalls::can_batch_syscalls() const {
+  if (initial_regs.sp().is_null()) {
+    return false;
+  }
+  // Before the rr page is mapped we're using a syscall instruction
+  // somewhere else.
+  if (initial_regs.ip() != AddressSpace::rr_page_syscall_entry_point(
+                              AddressSpace::TRACED, AddressSpace::UNPRIVILEGED,
+                              AddressSpace::RECORDING_AND_REPLAY, arch())) {
+    return false;
+  }
+  // Without the syscall buffer, our seccomp filter traps untraced syscalls
+  // too, so there'd be a ptrace stop for each syscall anyway.
+  return !t->session().is_recording() ||
+         t->session().as_record()->use_syscall_buffer();
+}
+
+template <typename Arch>
+void AutoRemoteSyscalls::syscall_batch_chunk(vector<BatchedSyscall>& syscalls,
+                                             size_t begin, size_t end) {
+  typedef typename Arch::unsigned_word word;
+  // Must match the loop in generate_rr_page.py.
+  struct Entry {
+    word syscallno;
+    word args[6];
+    word result;
+  };
+  struct Frame {
+    // The loop's call to the syscall stub pushes its return address here.
+    word return_address;
+    // The loop's stack pointer points here.
+    word table;
+    word count;
+  };
+
+  vector<uint8_t> buf(sizeof(Frame) + (end - begin) * sizeof(Entry));
+  AutoRestoreMem mem(*this, nullptr, buf.size());
+  Frame* frame = reinterpret_cast<Frame*>(buf.data());
+  frame->return_address = 0;
+  frame->table = (mem.get() + sizeof(Frame)).as_int();
+  frame->count = end - begin;
+  Entry* entries = reinterpret_cast<Entry*>(buf.data() + sizeof(Frame));
+  for (size_t i = begin; i < end; ++i) {
+    Entry& e = entries[i - begin];
+    e.syscallno = syscalls[i].syscallno;
+    for (int j = 0; j < 6; ++j) {
+      e.args[j] = syscalls[i].args[j];
+    }
+    e.result = 0;
+  }
+  t->write_bytes_helper(mem.get(), buf.size(), buf.data());
+
+  Registers callregs = regs();
+  callregs.set_ip(remote_code_ptr(RR_PAGE_SYSCALL_BATCH_ENTRY));
+  callregs.set_sp(mem.get() + offsetof(Frame, table));
+  t->set_regs(callregs);
+  t->resume_execution(RESUME_CONT, RESUME_WAIT, RESUME_NO_TICKS);
+  ASSERT(t, t->stop_sig() == SIGTRAP &&
+                t->ip() == remote_code_ptr(RR_PAGE_SYSCALL_BATCH_TRAP + 1))
+      << "Batched syscalls stopped unexpectedly with " << t->status()
+      << " at " << t->ip();
+
+  t->read_bytes_helper(mem.get(), buf.size(), buf.data());
+  for (size_t i = begin; i < end; ++i) {
+    syscalls[i].result = (typename Arch::signed_word)entries[i - begin].result;
+  }
+}
+
+template <typename Arch>
+void AutoRemoteSyscalls::syscall_batch_arch(vector<BatchedSyscall>& syscalls) {
+  for (size_t begin = 0; begin < syscalls.size();
+       begin += MAX_BATCHED_SYSCALLS) {
+    size_t end = min(syscalls.size(), begin + MAX_BATCHED_SYSCALLS);
+    syscall_batch_chunk<Arch>(syscalls, begin, end);
+  }
+}
+
+void AutoRemoteSyscalls::syscall_batch(vector<BatchedSyscall>& syscalls) {
+  if (!can_batch_syscalls()) {
+    for (auto& s : syscalls) {
+      Registers callregs = regs();
+      for (int j = 0; j < 6; ++j) {
+        callregs.set_arg(j + 1, s.args[j]);
+      }
+      syscall_helper(WAIT, s.syscallno, callregs);
+      s.result = t->regs().syscall_result_signed();
+    }
+    return;
+  }
+
+  RR_ARCH_FUNCTION(syscall_batch_arch, arch(), syscalls);
+}
+
+void AutoRemoteSyscalls::infallible_syscall_batch(
+    vector<BatchedSyscall>& syscalls) {
+  syscall_batch(syscalls);
+  for (auto& s : syscalls) {
+    ASSERT(t, !(-4096 < s.result && s.result < 0))
+        << "Syscall " << syscall_name(s.syscallno, arch())
+        << " failed with errno " << errno_name(-s.result);
+  }
+}
+
+AutoRemoteSyscalls::BatchedSyscall AutoRemoteSyscalls::batched_mmap_syscall(
+    remote_ptr<void> addr, size_t length, int prot, int flags, int child_fd,
+    uint64_t offset_pages) {
+  return has_mmap2_syscall(arch())
+             ? BatchedSyscall(syscall_number_for_mmap2(arch()), addr.as_int(),
+                              length, prot, flags, child_fd, offset_pages)
+             : BatchedSyscall(syscall_number_for_mmap(arch()), addr.as_int(),
+                              length, prot, flags, child_fd,
+                              offset_pages * page_size());
+}
+
 void AutoRemoteSyscalls::check_syscall_result(int syscallno) {
   long ret = t->regs().syscall_result_signed();
   if (-4096 < ret && ret < 0) {
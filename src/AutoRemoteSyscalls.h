@@ -176,6 +176,46 @@ public:
 
   int64_t infallible_lseek_syscall(int fd, int64_t offset, int whence);
 
+  /**
+   * A syscall queued for syscall_batch(). |result| receives the raw kernel
+   * return value.
+   */
+  struct BatchedSyscall {
+    BatchedSyscall(int syscallno, uintptr_t arg1 = 0, uintptr_t arg2 = 0,
+                   uintptr_t arg3 = 0, uintptr_t arg4 = 0, uintptr_t arg5 = 0,
+                   uintptr_t arg6 = 0)
+        : syscallno(syscallno), result(0) {
+      args[0] = arg1;
+      args[1] = arg2;
+      args[2] = arg3;
+      args[3] = arg4;
+      args[4] = arg5;
+      args[5] = arg6;
+    }
+    int syscallno;
+    uintptr_t args[6];
+    long result;
+  };
+
+  /**
+   * Make each of |syscalls| in order, storing their results. When the rr
+   * page is mapped this resumes the task just once per batch, running the
+   * syscalls from a loop in the rr page, instead of stopping at the entry
+   * and exit of every syscall. Otherwise they're made one at a time.
+   * The syscalls can't depend on each other's results, and mustn't disturb
+   * the stack or the rr page.
+   */
+  void syscall_batch(std::vector<BatchedSyscall>& syscalls);
+  void infallible_syscall_batch(std::vector<BatchedSyscall>& syscalls);
+
+  /**
+   * Returns an mmap or mmap2 syscall, whichever this arch needs, for
+   * syscall_batch().
+   */
+  BatchedSyscall batched_mmap_syscall(remote_ptr<void> addr, size_t length,
+                                      int prot, int flags, int child_fd,
+                                      uint64_t offset_pages);
+
   /** The Task in the context of which we're making syscalls. */
   Task* task() const { return t; }
 
@@ -235,6 +275,12 @@ private:
   }
 
   template <typename Arch> ScopedFd retrieve_fd_arch(int fd);
+  template <typename Arch>
+  void syscall_batch_arch(std::vector<BatchedSyscall>& syscalls);
+  template <typename Arch>
+  void syscall_batch_chunk(std::vector<BatchedSyscall>& syscalls, size_t begin,
+                           size_t end);
+  bool can_batch_syscalls() const;
 
   Task* t;
   Registers initial_regs;
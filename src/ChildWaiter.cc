@@ -0,0 +1,123 @@
+/* -*- Mode: C++; tab-width: 8; c-basic-offset: 2; indent-tabs-mode: nil; -*- */
+
+#include "ChildWaiter.h"
+
+#include <errno.h>
+#include <math.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+
+#include "log.h"
+#include "util.h"
+
+namespace rr {
+
+ChildWaiter::ChildWaiter() : armed_deadline(0) {
+  sigset_t mask;
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGCHLD);
+  // SIGCHLD is ignored by default, so unless it's blocked the kernel
+  // discards it before the signalfd can see it.
+  if (sigprocmask(SIG_BLOCK, &mask, nullptr)) {
+    FATAL() << "Can't block SIGCHLD";
+  }
+  sigchld_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+  if (!sigchld_fd.is_open()) {
+    FATAL() << "Can't create SIGCHLD signalfd";
+  }
+  timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (!timer_fd.is_open()) {
+    FATAL() << "Can't create timerfd";
+  }
+}
+
+ChildWaiter& ChildWaiter::get() {
+  static ChildWaiter waiter;
+  return waiter;
+}
+
+void ChildWaiter::arm_timer(double deadline) {
+  if (armed_deadline && armed_deadline <= deadline) {
+    // Already armed for this deadline or an earlier one. Successive waits
+    // push the deadline out a little each time, so rather than re-arming
+    // for every wait we re-arm only when an early expiration wakes us up
+    // before |deadline|.
+    return;
+  }
+  struct itimerspec spec = { { 0, 0 }, { 0, 0 } };
+  spec.it_value.tv_sec = (time_t)floor(deadline);
+  // Round up so the timer never fires before |deadline|.
+  spec.it_value.tv_nsec =
+      (long)ceil((deadline - spec.it_value.tv_sec) * 1000000000.0);
+  if (spec.it_value.tv_nsec >= 1000000000) {
+    ++spec.it_value.tv_sec;
+    spec.it_value.tv_nsec -= 1000000000;
+  }
+  // Re-arming discards any expiration of the previous deadline that nobody
+  // consumed.
+  if (timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &spec, nullptr)) {
+    FATAL() << "Can't arm timerfd";
+  }
+  armed_deadline = deadline;
+}
+
+pid_t ChildWaiter::timed_wait(pid_t pid, int options, WaitStatus* status,
+                              double deadline) {
+  bool timer_expired = false;
+  while (true) {
+    int raw_status = 0;
+    pid_t ret = waitpid(pid, &raw_status, options | WNOHANG);
+    if (ret > 0) {
+      *status = WaitStatus(raw_status);
+      return ret;
+    }
+    if (ret < 0) {
+      return ret;
+    }
+    if (timer_expired || monotonic_now_sec() >= deadline) {
+      return 0;
+    }
+
+    arm_timer(deadline);
+    // A SIGCHLD raised after the waitpid above stays pending, so the
+    // signalfd is readable and we won't miss it.
+    struct pollfd fds[2] = { { sigchld_fd, POLLIN, 0 },
+                             { timer_fd, POLLIN, 0 } };
+    if (poll(fds, 2, -1) < 0) {
+      return -1;
+    }
+    if (fds[0].revents & POLLIN) {
+      // SIGCHLD isn't a realtime signal, so at most one is ever pending and
+      // a single read consumes it. Its contents don't tell us anything
+      // waitpid won't.
+      struct signalfd_siginfo si;
+      read(sigchld_fd, &si, sizeof(si));
+    }
+    if (fds[1].revents & POLLIN) {
+      uint64_t expirations;
+      read(timer_fd, &expirations, sizeof(expirations));
+      // The timer may have been armed for an earlier wait's deadline, in
+      // which case we go round again and re-arm it for ours.
+      timer_expired = armed_deadline == deadline;
+      armed_deadline = 0;
+    }
+  }
+}
+
+pid_t ChildWaiter::wait(pid_t pid, int options, WaitStatus* status,
+                        double deadline) {
+  if (!deadline) {
+    int raw_status = 0;
+    pid_t ret = waitpid(pid, &raw_status, options);
+    if (ret > 0) {
+      *status = WaitStatus(raw_status);
+    }
+    return ret;
+  }
+  return get().timed_wait(pid, options, status, deadline);
+}
+
+} // namespace rr
@@ -0,0 +1,58 @@
+/* -*- Mode: C++; tab-width: 8; c-basic-offset: 2; indent-tabs-mode: nil; -*- */
+
+#ifndef RR_CHILD_WAITER_H_
+#define RR_CHILD_WAITER_H_
+
+#include <sys/types.h>
+
+#include "ScopedFd.h"
+#include "WaitStatus.h"
+
+namespace rr {
+
+/**
+ * Waits for tracee status changes with an optional deadline.
+ *
+ * Timed waits used to arm and disarm an ITIMER_REAL around every blocking
+ * waitpid() and rely on SIGALRM interrupting it. Instead we keep a SIGCHLD
+ * signalfd and a timerfd open for the life of the process and poll() on
+ * both. A deadline is absolute: signals that interrupt the wait don't
+ * restart the clock. The timer stays armed across waits and is only
+ * re-armed when it fires before the current wait's deadline, so a timed
+ * wait for a task that has already stopped costs one waitpid(), and one
+ * that blocks costs waitpid(), poll(), a signalfd read and waitpid().
+ *
+ * SIGCHLD is blocked in rr (so the signalfd can observe it) once the
+ * first timed wait happens. Tracees unblock it before exec.
+ */
+class ChildWaiter {
+public:
+  /**
+   * Like waitpid(pid, ..., options), but gives up and returns 0 when
+   * monotonic_now_sec() reaches |deadline|. A |deadline| of 0 means wait
+   * forever. Returns -1 with errno set on error; in particular EINTR is
+   * returned when a signal handler ran during the wait.
+   * |pid| can be -1 to wait for any child.
+   */
+  static pid_t wait(pid_t pid, int options, WaitStatus* status,
+                    double deadline = 0);
+
+private:
+  ChildWaiter();
+
+  static ChildWaiter& get();
+
+  pid_t timed_wait(pid_t pid, int options, WaitStatus* status,
+                   double deadline);
+  void arm_timer(double deadline);
+
+  ScopedFd sigchld_fd;
+  ScopedFd timer_fd;
+  // The deadline timer_fd is currently armed for, or 0 if it isn't armed
+  // or has expired.
+  double armed_deadline;
+};
+
+} // namespace rr
+
+#endif /* RR_CHILD_WAITER_H_ */
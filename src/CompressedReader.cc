@@ -6,6 +6,7 @@
 
 #include <assert.h>
 #include <fcntl.h>
+#include <signal.h>
 #include <stdint.h>
 #include <string.h>
 #include <sys/types.h>
@@ -13,15 +14,71 @@
 #include <unistd.h>
 #include <zlib.h>
 
+#include <deque>
+#include <map>
+#include <set>
+
 #include "CompressedWriter.h"
 
 using namespace std;
 
 namespace rr {
 
+/**
+ * Blocks decoded ahead of time by the prefetch thread, keyed by the file
+ * offset of their header. Readers copied from one another read the same
+ * file and share one BlockCache.
+ */
+struct CompressedReader::BlockCache {
+  struct Block {
+    std::vector<uint8_t> data;
+    uint64_t next_offset;
+    bool eof;
+  };
+
+  BlockCache(const shared_ptr<ScopedFd>& fd) : fd(fd) {}
+
+  /**
+   * If the block at |offset| has been prefetched, move it to |block| and
+   * return true. Waits for it if it's being decoded right now.
+   */
+  bool take(uint64_t offset, Block* block);
+  /**
+   * Ask the prefetch thread to decode the block at |offset|.
+   */
+  static void prefetch(const shared_ptr<BlockCache>& cache, uint64_t offset);
+  /**
+   * Read and decompress the block at |offset|.
+   */
+  static bool decode(const ScopedFd& fd, uint64_t offset, Block* block);
+
+  shared_ptr<ScopedFd> fd;
+  map<uint64_t, Block> blocks;
+  set<uint64_t> in_flight;
+
+private:
+  static void* prefetch_thread(void*);
+
+  // Protects all BlockCaches and |queue|. None of this is ever destroyed,
+  // so the prefetch thread can't race with static destructors at exit.
+  static pthread_mutex_t lock;
+  static pthread_cond_t cond;
+  static deque<pair<shared_ptr<BlockCache>, uint64_t> >* queue;
+};
+
+pthread_mutex_t CompressedReader::BlockCache::lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t CompressedReader::BlockCache::cond = PTHREAD_COND_INITIALIZER;
+deque<pair<shared_ptr<CompressedReader::BlockCache>, uint64_t> >*
+    CompressedReader::BlockCache::queue;
+
+// Normally only the block after a reader's position is useful; the rest
+// serve copies of the reader at other positions.
+static const size_t MAX_CACHED_BLOCKS = 4;
+
 CompressedReader::CompressedReader(const string& filename)
     : fd(new ScopedFd(filename.c_str(), O_CLOEXEC | O_RDONLY | O_LARGEFILE)) {
   fd_offset = 0;
+  uncompressed_fd_offset = 0;
   error = !fd->is_open();
   if (error) {
     eof = false;
@@ -29,16 +86,21 @@ CompressedReader::CompressedReader(const string& filename)
     char ch;
     eof = pread(*fd, &ch, 1, fd_offset) == 0;
   }
+  cache = make_shared<BlockCache>(fd);
   buffer_read_pos = 0;
+  pending_skip = 0;
   have_saved_state = false;
 }
 
 CompressedReader::CompressedReader(const CompressedReader& other) {
   fd = other.fd;
+  cache = other.cache;
   fd_offset = other.fd_offset;
+  uncompressed_fd_offset = other.uncompressed_fd_offset;
   error = other.error;
   eof = other.eof;
   buffer_read_pos = other.buffer_read_pos;
+  pending_skip = other.pending_skip;
   buffer = other.buffer;
   have_saved_state = false;
   assert(!other.have_saved_state);
@@ -89,48 +151,154 @@ static bool do_decompress(std::vector<uint8_t>& compressed,
   return true;
 }
 
-bool CompressedReader::read(void* data, size_t size) {
-  while (size > 0) {
-    if (error) {
+bool CompressedReader::BlockCache::decode(const ScopedFd& fd, uint64_t offset,
+                                          Block* block) {
+  CompressedWriter::BlockHeader header;
+  if (!read_all(fd, sizeof(header), &header, &offset)) {
+    return false;
+  }
+
+  std::vector<uint8_t> compressed_buf;
+  compressed_buf.resize(header.compressed_length);
+  if (!read_all(fd, compressed_buf.size(), &compressed_buf[0], &offset)) {
+    return false;
+  }
+
+  char ch;
+  block->eof = pread(fd, &ch, 1, offset) == 0;
+  block->next_offset = offset;
+
+  block->data.resize(header.uncompressed_length);
+  return do_decompress(compressed_buf, block->data);
+}
+
+bool CompressedReader::BlockCache::take(uint64_t offset, Block* block) {
+  pthread_mutex_lock(&lock);
+  while (true) {
+    auto it = blocks.find(offset);
+    if (it != blocks.end()) {
+      *block = std::move(it->second);
+      blocks.erase(it);
+      pthread_mutex_unlock(&lock);
+      return true;
+    }
+    if (!in_flight.count(offset)) {
+      pthread_mutex_unlock(&lock);
       return false;
     }
+    pthread_cond_wait(&cond, &lock);
+  }
+}
+
+void CompressedReader::BlockCache::prefetch(
+    const shared_ptr<BlockCache>& cache, uint64_t offset) {
+  pthread_mutex_lock(&lock);
+  if (!cache->blocks.count(offset) && !cache->in_flight.count(offset)) {
+    if (!queue) {
+      queue = new deque<pair<shared_ptr<BlockCache>, uint64_t> >();
+      // Signals are for the main thread.
+      sigset_t all_signals, old_mask;
+      sigfillset(&all_signals);
+      pthread_sigmask(SIG_SETMASK, &all_signals, &old_mask);
+      pthread_t thread;
+      pthread_create(&thread, nullptr, prefetch_thread, nullptr);
+      pthread_setname_np(thread, "trace prefetch");
+      pthread_detach(thread);
+      pthread_sigmask(SIG_SETMASK, &old_mask, nullptr);
+    }
+    cache->in_flight.insert(offset);
+    queue->push_back(make_pair(cache, offset));
+    pthread_cond_broadcast(&cond);
+  }
+  pthread_mutex_unlock(&lock);
+}
 
-    if (buffer_read_pos < buffer.size()) {
-      size_t amount = std::min(size, buffer.size() - buffer_read_pos);
-      memcpy(data, &buffer[buffer_read_pos], amount);
-      size -= amount;
-      data = static_cast<char*>(data) + amount;
-      buffer_read_pos += amount;
-      continue;
+void* CompressedReader::BlockCache::prefetch_thread(void*) {
+  pthread_mutex_lock(&lock);
+  while (true) {
+    while (queue->empty()) {
+      pthread_cond_wait(&cond, &lock);
     }
+    shared_ptr<BlockCache> cache = queue->front().first;
+    uint64_t offset = queue->front().second;
+    queue->pop_front();
+    pthread_mutex_unlock(&lock);
+
+    Block block;
+    bool ok = decode(*cache->fd, offset, &block);
 
-    if (have_saved_state && !have_saved_buffer) {
-      std::swap(buffer, saved_buffer);
-      have_saved_buffer = true;
+    pthread_mutex_lock(&lock);
+    cache->in_flight.erase(offset);
+    // If decoding failed, the reader will fail the same way and report it.
+    if (ok) {
+      cache->blocks[offset] = std::move(block);
+      if (cache->blocks.size() > MAX_CACHED_BLOCKS) {
+        cache->blocks.erase(cache->blocks.begin());
+      }
     }
+    pthread_cond_broadcast(&cond);
+  }
+  return nullptr;
+}
+
+bool CompressedReader::read_block() {
+  BlockCache::Block block;
+  if (!cache->take(fd_offset, &block) &&
+      !BlockCache::decode(*fd, fd_offset, &block)) {
+    return false;
+  }
+  fd_offset = block.next_offset;
+  uncompressed_fd_offset += block.data.size();
+  eof = block.eof;
+  buffer = std::move(block.data);
+  buffer_read_pos = 0;
+  if (!eof) {
+    BlockCache::prefetch(cache, fd_offset);
+  }
+  return true;
+}
+
+bool CompressedReader::refill() {
+  if (error) {
+    return false;
+  }
 
-    CompressedWriter::BlockHeader header;
-    if (!read_all(*fd, sizeof(header), &header, &fd_offset)) {
+  if (have_saved_state && !have_saved_buffer) {
+    std::swap(buffer, saved_buffer);
+    have_saved_buffer = true;
+  }
+
+  if (!read_block()) {
+    error = true;
+    return false;
+  }
+  if (pending_skip) {
+    if (pending_skip > buffer.size()) {
       error = true;
       return false;
     }
+    buffer_read_pos = pending_skip;
+    pending_skip = 0;
+  }
+  return true;
+}
 
-    std::vector<uint8_t> compressed_buf;
-    compressed_buf.resize(header.compressed_length);
-    if (!read_all(*fd, compressed_buf.size(), &compressed_buf[0], &fd_offset)) {
-      error = true;
+bool CompressedReader::read(void* data, size_t size) {
+  while (size > 0) {
+    if (error) {
       return false;
     }
 
-    char ch;
-    if (pread(*fd, &ch, 1, fd_offset) == 0) {
-      eof = true;
+    if (buffer_read_pos < buffer.size()) {
+      size_t amount = std::min(size, buffer.size() - buffer_read_pos);
+      memcpy(data, &buffer[buffer_read_pos], amount);
+      size -= amount;
+      data = static_cast<char*>(data) + amount;
+      buffer_read_pos += amount;
+      continue;
     }
 
-    buffer.resize(header.uncompressed_length);
-    buffer_read_pos = 0;
-    if (!do_decompress(compressed_buf, buffer)) {
-      error = true;
+    if (!refill()) {
       return false;
     }
   }
@@ -140,19 +308,74 @@ bool CompressedReader::read(void* data, size_t size) {
 void CompressedReader::rewind() {
   assert(!have_saved_state);
   fd_offset = 0;
+  uncompressed_fd_offset = 0;
   buffer_read_pos = 0;
+  pending_skip = 0;
+  buffer.clear();
+  eof = false;
+}
+
+bool CompressedReader::seek(uint64_t offset) {
+  assert(!have_saved_state);
+  uint64_t buffer_start = uncompressed_fd_offset - buffer.size();
+  if (buffer_start <= offset && offset < uncompressed_fd_offset) {
+    buffer_read_pos = offset - buffer_start;
+    pending_skip = 0;
+    return true;
+  }
+
+  uint64_t block_offset = 0;
+  uint64_t block_start = 0;
+  if (offset >= uncompressed_fd_offset) {
+    // Seeking forward; start from the next block.
+    block_offset = fd_offset;
+    block_start = uncompressed_fd_offset;
+  }
+  CompressedWriter::BlockHeader header;
+  while (true) {
+    uint64_t header_offset = block_offset;
+    if (!read_all(*fd, sizeof(header), &header, &header_offset)) {
+      if (block_start != offset) {
+        return false;
+      }
+      // Seeking to the very end.
+      fd_offset = block_offset;
+      uncompressed_fd_offset = block_start;
+      buffer.clear();
+      buffer_read_pos = 0;
+      pending_skip = 0;
+      eof = true;
+      return true;
+    }
+    if (offset < block_start + header.uncompressed_length) {
+      break;
+    }
+    block_start += header.uncompressed_length;
+    block_offset = header_offset + header.compressed_length;
+  }
+
+  fd_offset = block_offset;
+  uncompressed_fd_offset = block_start;
   buffer.clear();
+  buffer_read_pos = 0;
+  pending_skip = offset - block_start;
   eof = false;
+  return true;
 }
 
-void CompressedReader::close() { fd = nullptr; }
+void CompressedReader::close() {
+  fd = nullptr;
+  cache = nullptr;
+}
 
 void CompressedReader::save_state() {
   assert(!have_saved_state);
   have_saved_state = true;
   have_saved_buffer = false;
   saved_fd_offset = fd_offset;
+  saved_uncompressed_fd_offset = uncompressed_fd_offset;
   saved_buffer_read_pos = buffer_read_pos;
+  saved_pending_skip = pending_skip;
 }
 
 void CompressedReader::restore_state() {
@@ -162,11 +385,19 @@ void CompressedReader::restore_state() {
     eof = false;
   }
   fd_offset = saved_fd_offset;
+  uncompressed_fd_offset = saved_uncompressed_fd_offset;
   if (have_saved_buffer) {
     std::swap(buffer, saved_buffer);
     saved_buffer.clear();
   }
   buffer_read_pos = saved_buffer_read_pos;
+  pending_skip = saved_pending_skip;
+}
+
+void CompressedReader::discard_state() {
+  assert(have_saved_state);
+  have_saved_state = false;
+  saved_buffer.clear();
 }
 
 uint64_t CompressedReader::uncompressed_bytes() const {
@@ -180,6 +411,17 @@ uint64_t CompressedReader::uncompressed_bytes() const {
   return uncompressed_bytes;
 }
 
+std::map<uint32_t, uint64_t> CompressedReader::compression_levels() const {
+  uint64_t offset = 0;
+  std::map<uint32_t, uint64_t> levels;
+  CompressedWriter::BlockHeader header;
+  while (read_all(*fd, sizeof(header), &header, &offset)) {
+    ++levels[header.compression_level];
+    offset += header.compressed_length;
+  }
+  return levels;
+}
+
 uint64_t CompressedReader::compressed_bytes() const {
   return lseek(*fd, 0, SEEK_END);
 }
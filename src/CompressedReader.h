@@ -6,6 +6,8 @@
 #include <pthread.h>
 #include <stdint.h>
 
+#include <algorithm>
+#include <map>
 #include <memory>
 #include <vector>
 #include <string>
@@ -16,8 +18,10 @@ namespace rr {
 
 /**
  * CompressedReader opens an input file written by CompressedWriter
- * and reads data from it. Currently data is decompressed by the thread that
- * calls read().
+ * and reads data from it. Whenever read() moves on to a new block, a
+ * background thread starts decompressing the block after it, so
+ * sequential reads mostly find their next block already decoded. Readers
+ * copied from each other share those prefetched blocks.
  */
 class CompressedReader {
 public:
@@ -29,7 +33,32 @@ public:
   // Returns true if successful. Otherwise there's an error and good()
   // will be false.
   bool read(void* data, size_t size);
+  /**
+   * Like read(), but instead of copying the data out, call |consumer| with
+   * one or more consecutive pieces of it that point into our decompression
+   * buffer. The pointers are only valid during the call.
+   */
+  template <typename F> bool read_in_place(size_t size, F consumer) {
+    while (size > 0) {
+      if (buffer_read_pos == buffer.size() && !refill()) {
+        return false;
+      }
+      size_t amount = std::min(size, buffer.size() - buffer_read_pos);
+      consumer(&buffer[buffer_read_pos], amount);
+      size -= amount;
+      buffer_read_pos += amount;
+    }
+    return true;
+  }
   void rewind();
+  /**
+   * Move to |offset| bytes from the start of the uncompressed data. Only the
+   * block headers between the current block (or the start of the file, when
+   * seeking backwards) and |offset| are read; the block containing |offset|
+   * isn't decompressed until the next read(). Returns false if |offset| is
+   * past the end of the data.
+   */
+  bool seek(uint64_t offset);
   void close();
 
   /**
@@ -40,6 +69,10 @@ public:
    * Restore previously saved position.
    */
   void restore_state();
+  /**
+   * Forget the previously saved position, keeping the current one.
+   */
+  void discard_state();
 
   /**
    * Gathers stats on the file stream. These are independent of what's
@@ -47,6 +80,10 @@ public:
    */
   uint64_t uncompressed_bytes() const;
   uint64_t compressed_bytes() const;
+  /**
+   * Returns the number of blocks compressed at each zlib level.
+   */
+  std::map<uint32_t, uint64_t> compression_levels() const;
 
   template <typename T> CompressedReader& operator>>(T& value) {
     read(&value, sizeof(value));
@@ -79,21 +116,41 @@ public:
   }
 
 protected:
+  struct BlockCache;
+
+  /**
+   * Read and decompress the block at fd_offset into |buffer| and advance
+   * fd_offset past it, using a prefetched copy if there is one.
+   */
+  bool read_block();
+  /**
+   * Replace the exhausted |buffer| with the next block. Returns false (and
+   * sets |error|) on failure.
+   */
+  bool refill();
+
   /* Our fd might be the dup of another fd, so we can't rely on its current file
      position.
      Instead track the current position in fd_offset and use pread. */
   uint64_t fd_offset;
+  /* Uncompressed offset of the start of the block at fd_offset */
+  uint64_t uncompressed_fd_offset;
   std::shared_ptr<ScopedFd> fd;
+  std::shared_ptr<BlockCache> cache;
   bool error;
   bool eof;
   std::vector<uint8_t> buffer;
   size_t buffer_read_pos;
+  /* Bytes to skip at the start of the next block read, after seek() */
+  size_t pending_skip;
 
   bool have_saved_state;
   bool have_saved_buffer;
   uint64_t saved_fd_offset;
+  uint64_t saved_uncompressed_fd_offset;
   std::vector<uint8_t> saved_buffer;
   size_t saved_buffer_read_pos;
+  size_t saved_pending_skip;
 };
 
 } // namespace rr
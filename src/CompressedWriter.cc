@@ -5,11 +5,18 @@
 #include "CompressedWriter.h"
 
 #include <assert.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <signal.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 #include <zlib.h>
 
@@ -17,42 +24,123 @@ using namespace std;
 
 namespace rr {
 
+// Blocks are never made smaller than max_block_size / MIN_BLOCK_FRACTION.
+static const size_t MIN_BLOCK_FRACTION = 16;
+// O_DIRECT writes must be aligned to (at most) this.
+static const size_t IO_ALIGN = 4096;
+// Data that compresses to more than this fraction of its size isn't worth
+// compressing harder.
+static const double INCOMPRESSIBLE_RATIO = 0.9;
+
+const int CompressedWriter::DEFAULT_LEVEL;
+
+static uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+static size_t max_compressed_size(size_t block_size) {
+  // Add slop for incompressible data
+  return (size_t)(block_size * 1.1) + sizeof(CompressedWriter::BlockHeader);
+}
+
 void* CompressedWriter::compression_thread_callback(void* p) {
   static_cast<CompressedWriter*>(p)->compression_thread();
   return nullptr;
 }
 
+void* CompressedWriter::io_thread_callback(void* p) {
+  static_cast<CompressedWriter*>(p)->io_thread();
+  return nullptr;
+}
+
 CompressedWriter::CompressedWriter(const string& filename, size_t block_size,
-                                   uint32_t num_threads)
+                                   uint32_t num_threads, IoMode io_mode,
+                                   int min_level, int max_level)
     : fd(filename.c_str(),
-         O_CLOEXEC | O_WRONLY | O_CREAT | O_EXCL | O_LARGEFILE, 0400) {
-  this->block_size = block_size;
-  threads.resize(num_threads);
-  thread_pos.resize(num_threads);
-  buffer.resize(block_size * (num_threads + 2));
-  pthread_mutex_init(&mutex, nullptr);
-  pthread_cond_init(&cond, nullptr);
-
-  for (uint32_t i = 0; i < num_threads; ++i) {
-    thread_pos[i] = UINT64_MAX;
+         O_CLOEXEC | O_WRONLY | O_CREAT | O_EXCL | O_LARGEFILE, 0400),
+      min_level(min_level),
+      max_level(max_level),
+      io_mode(io_mode),
+      io_buffer(nullptr),
+      io_buffer_size(0) {
+  assert(Z_NO_COMPRESSION <= min_level && min_level <= max_level &&
+         max_level <= Z_BEST_COMPRESSION);
+  max_block_size = block_size;
+  min_block_size = max<size_t>(block_size / MIN_BLOCK_FRACTION, 1);
+  num_blocks = num_threads + 2;
+  blocks = unique_ptr<Block[]>(new Block[num_blocks]);
+  for (size_t i = 0; i < num_blocks; ++i) {
+    blocks[i].seq = i;
+    blocks[i].data = unique_ptr<uint8_t[]>(new uint8_t[block_size]);
   }
-  next_thread_pos = 0;
-  next_thread_end_pos = 0;
-  closing = false;
-  write_error = false;
 
-  producer_reserved_pos = 0;
-  producer_reserved_write_pos = 0;
-  producer_reserved_upto_pos = 0;
+  next_compress_ticket = 0;
+  next_write_ticket = 0;
+  end_ticket = UINT64_MAX;
+  write_error = false;
+  wake_seq = 0;
+  waiters = 0;
+  io_staged_end = 0;
+  io_written_pos = 0;
+  io_closing = false;
+  bytes_written = 0;
+  compressed_in_bytes = 0;
+  compressed_out_bytes = 0;
+  write_stall_ns = 0;
+  max_io_queue_bytes = 0;
+
+  producer_ticket = 0;
+  producer_fill = 0;
+  producer_has_block = false;
+  target_block_size = max_block_size;
+  level = min(max(DEFAULT_LEVEL, min_level), max_level);
+  sampled_in_bytes = 0;
+  sampled_out_bytes = 0;
+  sampled_incompressible = false;
+  uncompressed_bytes = 0;
+  producer_stall_ns = 0;
+  max_queue_depth = 0;
   error = false;
   if (fd < 0) {
     error = true;
     return;
   }
 
-  // Hold the lock so threads don't inspect the 'threads' array
-  // until we've finished initializing it.
-  pthread_mutex_lock(&mutex);
+  if (io_mode == ASYNC_DIRECT_IO) {
+    // Leave room for a whole block even when IO_ALIGN - 1 bytes are waiting
+    // for more data to complete an aligned write.
+    io_buffer_size =
+        (2 * max_compressed_size(block_size) + IO_ALIGN - 1) / IO_ALIGN *
+            IO_ALIGN +
+        IO_ALIGN;
+    if (posix_memalign(reinterpret_cast<void**>(&io_buffer), IO_ALIGN,
+                       io_buffer_size)) {
+      // No threads have been started; close() must not wait for any.
+      io_buffer = nullptr;
+      fd.close();
+      error = true;
+      return;
+    }
+  }
+
+  // Our threads must not take signals meant for the main thread. In
+  // particular a process-directed SIGCHLD that the main thread blocks (see
+  // ChildWaiter) would be delivered to, and discarded by, one of them.
+  sigset_t all_signals, old_mask;
+  sigfillset(&all_signals);
+  pthread_sigmask(SIG_SETMASK, &all_signals, &old_mask);
+
+  if (io_mode == ASYNC_DIRECT_IO) {
+    // Not all filesystems support O_DIRECT (e.g. tmpfs); plain writes from
+    // the I/O thread are still asynchronous.
+    int flags = fcntl(fd, F_GETFL);
+    fcntl(fd, F_SETFL, flags | O_DIRECT);
+    pthread_create(&io_thread_handle, nullptr, io_thread_callback, this);
+  }
+
+  threads.resize(num_threads);
   for (uint32_t i = 0; i < num_threads; ++i) {
     pthread_create(&threads[i], nullptr, compression_thread_callback, this);
     size_t last_slash = filename.rfind('/');
@@ -62,141 +150,283 @@ CompressedWriter::CompressedWriter(const string& filename, size_t block_size,
                                    : filename.substr(last_slash + 1));
     pthread_setname_np(threads[i], thread_name.substr(0, 15).c_str());
   }
-  pthread_mutex_unlock(&mutex);
+
+  pthread_sigmask(SIG_SETMASK, &old_mask, nullptr);
 }
 
 CompressedWriter::~CompressedWriter() {
   close();
-  pthread_mutex_destroy(&mutex);
-  pthread_cond_destroy(&cond);
+  free(io_buffer);
+}
+
+template <typename Predicate>
+void CompressedWriter::wait_until(Predicate pred) {
+  if (pred()) {
+    return;
+  }
+  // All accesses to 'waiters' and 'wake_seq' are sequentially consistent,
+  // so either notify() sees us in 'waiters' and wakes us, or we see its
+  // increment of 'wake_seq' (and hence the state change preceding it).
+  ++waiters;
+  while (true) {
+    uint32_t seen = wake_seq;
+    if (pred()) {
+      break;
+    }
+    syscall(SYS_futex, &wake_seq, FUTEX_WAIT_PRIVATE, seen, nullptr, nullptr,
+            0);
+  }
+  --waiters;
+}
+
+void CompressedWriter::notify() {
+  ++wake_seq;
+  if (waiters > 0) {
+    syscall(SYS_futex, &wake_seq, FUTEX_WAKE_PRIVATE, INT_MAX, nullptr,
+            nullptr, 0);
+  }
 }
 
 void CompressedWriter::write(const void* data, size_t size) {
   while (!error && size > 0) {
-    uint64_t reservation_size =
-        producer_reserved_upto_pos - producer_reserved_write_pos;
-    if (reservation_size == 0) {
-      update_reservation(WAIT);
+    if (!producer_has_block) {
+      acquire_block();
       continue;
     }
-    size_t buf_offset = (size_t)(producer_reserved_write_pos % buffer.size());
-    size_t amount = min(buffer.size() - buf_offset,
-                        (size_t)min<uint64_t>(reservation_size, size));
-    memcpy(&buffer[buf_offset], data, amount);
-    producer_reserved_write_pos += amount;
+    Block& block = blocks[producer_ticket % num_blocks];
+    size_t amount = min(target_block_size - producer_fill, size);
+    memcpy(block.data.get() + producer_fill, data, amount);
+    producer_fill += amount;
+    uncompressed_bytes += amount;
     data = static_cast<const char*>(data) + amount;
     size -= amount;
+    if (producer_fill >= target_block_size) {
+      publish_block();
+    }
   }
+}
 
-  if (!error &&
-      producer_reserved_write_pos - producer_reserved_pos >=
-          buffer.size() / 2) {
-    update_reservation(NOWAIT);
+void CompressedWriter::acquire_block() {
+  Block& block = blocks[producer_ticket % num_blocks];
+  uint64_t ticket = producer_ticket;
+  if (block.seq.load(memory_order_acquire) != ticket) {
+    // Every block is queued or being compressed. Use smaller blocks so
+    // compression threads hand space back to us sooner, and compress them
+    // as fast as we're allowed to.
+    target_block_size = max(target_block_size / 2, min_block_size);
+    level = min_level;
+    uint64_t start = now_ns();
+    wait_until([&]() {
+      return block.seq.load(memory_order_acquire) == ticket || write_error;
+    });
+    producer_stall_ns += now_ns() - start;
+  }
+  if (write_error) {
+    error = true;
+    return;
   }
+  producer_fill = 0;
+  producer_has_block = true;
 }
 
-void CompressedWriter::update_reservation(WaitFlag wait_flag) {
-  pthread_mutex_lock(&mutex);
+bool CompressedWriter::recently_incompressible() {
+  uint64_t out = compressed_out_bytes.load(memory_order_relaxed);
+  uint64_t in = compressed_in_bytes.load(memory_order_relaxed);
+  if (in > sampled_in_bytes && out >= sampled_out_bytes) {
+    sampled_incompressible = out - sampled_out_bytes >
+                             (in - sampled_in_bytes) * INCOMPRESSIBLE_RATIO;
+    sampled_in_bytes = in;
+    sampled_out_bytes = out;
+  }
+  return sampled_incompressible;
+}
 
-  next_thread_end_pos = producer_reserved_write_pos;
-  producer_reserved_pos = producer_reserved_write_pos;
+void CompressedWriter::publish_block() {
+  Block& block = blocks[producer_ticket % num_blocks];
+  block.length = producer_fill;
+  uint64_t written = next_write_ticket.load(memory_order_acquire);
+  uint64_t depth = producer_ticket + 1 - written;
+  max_queue_depth = max(max_queue_depth, depth);
+  if (written == producer_ticket) {
+    // Everything before this block has been written, so the compression
+    // threads are keeping up. Favor compression ratio, if the data
+    // compresses at all.
+    target_block_size = min(target_block_size * 2, max_block_size);
+    // Blocks stored at level 0 tell us nothing about how compressible the
+    // data is, so always climb back to level 1 to find out. The ratio
+    // check only ever lowers the level to 1; only stalls and backlogs
+    // take it to 0.
+    if (level < 1 || !recently_incompressible()) {
+      level = min(level + 1, max_level);
+    } else {
+      level = max(level - 1, max(min_level, 1));
+    }
+  } else if (depth * 2 > num_blocks) {
+    // The compression threads are falling behind. Speed them up before we
+    // run out of free blocks and stall.
+    level = max(level - 1, min_level);
+  }
+  block.level = level;
+  block.seq.store(producer_ticket + 1, memory_order_release);
+  ++producer_ticket;
+  producer_has_block = false;
+  notify();
+}
 
-  // Wake up threads that might be waiting to consume data.
-  pthread_cond_broadcast(&cond);
+void CompressedWriter::compression_thread() {
+  vector<uint8_t> outputbuf;
+  outputbuf.resize(max_compressed_size(max_block_size));
+  BlockHeader* header = reinterpret_cast<BlockHeader*>(&outputbuf[0]);
 
-  while (!error) {
-    if (write_error) {
-      error = true;
+  while (true) {
+    uint64_t ticket = next_compress_ticket++;
+    Block& block = blocks[ticket % num_blocks];
+    wait_until([&]() {
+      return block.seq.load(memory_order_acquire) == ticket + 1 ||
+             ticket >= end_ticket;
+    });
+    if (block.seq.load(memory_order_acquire) != ticket + 1) {
+      // We're closing and the producer will never publish this ticket.
       break;
     }
 
-    uint64_t completed_pos = next_thread_pos;
-    for (uint32_t i = 0; i < thread_pos.size(); ++i) {
-      completed_pos = min(completed_pos, thread_pos[i]);
+    // block.length must be <= max_block_size, therefore fits in 32 bits.
+    header->uncompressed_length = block.length;
+    header->compressed_length = 0;
+    header->compression_level = block.level;
+    if (!write_error) {
+      header->compressed_length =
+          do_compress(block.data.get(), block.length, block.level,
+                      &outputbuf[sizeof(BlockHeader)],
+                      outputbuf.size() - sizeof(BlockHeader));
+      if (block.level > 0) {
+        compressed_in_bytes += block.length;
+        compressed_out_bytes += header->compressed_length;
+      }
     }
-    producer_reserved_upto_pos = completed_pos + buffer.size();
-    if (producer_reserved_pos < producer_reserved_upto_pos ||
-        wait_flag == NOWAIT) {
-      break;
+
+    // Wait until we're the next thread that needs to write
+    wait_until([&]() {
+      return next_write_ticket.load(memory_order_acquire) == ticket;
+    });
+
+    if (header->compressed_length == 0) {
+      write_error = true;
+    }
+    if (!write_error) {
+      write_output(&outputbuf[0],
+                   sizeof(BlockHeader) + header->compressed_length);
     }
 
-    pthread_cond_wait(&cond, &mutex);
+    block.seq.store(ticket + num_blocks, memory_order_release);
+    next_write_ticket.store(ticket + 1, memory_order_release);
+    // We might need to unblock the producer thread or a compressor thread
+    // waiting for us to write.
+    notify();
   }
-
-  pthread_mutex_unlock(&mutex);
 }
 
-void CompressedWriter::compression_thread() {
-  pthread_mutex_lock(&mutex);
+void CompressedWriter::write_output(const uint8_t* data, size_t length) {
+  uint64_t start = now_ns();
+  if (io_mode == BLOCKING_IO) {
+    if (::write(fd, data, length) != ssize_t(length)) {
+      write_error = true;
+    } else {
+      bytes_written += length;
+    }
+    write_stall_ns += now_ns() - start;
+    return;
+  }
 
-  int thread_index;
-  pthread_t self = pthread_self();
-  for (thread_index = 0; threads[thread_index] != self; ++thread_index) {
+  // Only the thread whose turn it is to write gets here, so we're the only
+  // writer of io_staged_end.
+  uint64_t end = io_staged_end;
+  bool stalled = false;
+  wait_until([&]() {
+    bool ok = end + length - io_written_pos <= io_buffer_size || write_error;
+    stalled = stalled || !ok;
+    return ok;
+  });
+  if (write_error) {
+    return;
+  }
+  size_t offset = end % io_buffer_size;
+  size_t first = min(length, io_buffer_size - offset);
+  memcpy(io_buffer + offset, data, first);
+  memcpy(io_buffer, data + first, length - first);
+  io_staged_end = end + length;
+  uint64_t queued = end + length - io_written_pos;
+  uint64_t old_max = max_io_queue_bytes;
+  while (queued > old_max &&
+         !max_io_queue_bytes.compare_exchange_weak(old_max, queued)) {
+  }
+  if (stalled) {
+    write_stall_ns += now_ns() - start;
   }
+  notify();
+}
 
-  // Add slop for incompressible data
-  vector<uint8_t> outputbuf;
-  outputbuf.resize((size_t)(block_size * 1.1) + sizeof(BlockHeader));
-  BlockHeader* header = reinterpret_cast<BlockHeader*>(&outputbuf[0]);
+bool CompressedWriter::io_write(const uint8_t* data, size_t length,
+                                uint64_t offset) {
+  while (length > 0) {
+    ssize_t ret = pwrite64(fd, data, length, offset);
+    if (ret < 0 && errno == EINVAL && (fcntl(fd, F_GETFL) & O_DIRECT)) {
+      // The filesystem accepted O_DIRECT but not this write.
+      fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+      continue;
+    }
+    if (ret <= 0) {
+      return false;
+    }
+    data += ret;
+    length -= ret;
+    offset += ret;
+  }
+  return true;
+}
 
+void CompressedWriter::io_thread() {
+  uint64_t pos = 0;
   while (true) {
-    if (!write_error && next_thread_pos < next_thread_end_pos &&
-        (closing || next_thread_pos + block_size <= next_thread_end_pos)) {
-      thread_pos[thread_index] = next_thread_pos;
-      next_thread_pos = min(next_thread_end_pos, next_thread_pos + block_size);
-      // header->uncompressed_length must be <= block_size,
-      // therefore fits in a size_t.
-      header->uncompressed_length =
-          (size_t)(next_thread_pos - thread_pos[thread_index]);
-
-      pthread_mutex_unlock(&mutex);
-      header->compressed_length =
-          do_compress(thread_pos[thread_index], header->uncompressed_length,
-                      &outputbuf[sizeof(BlockHeader)],
-                      outputbuf.size() - sizeof(BlockHeader));
-      pthread_mutex_lock(&mutex);
-
-      if (header->compressed_length == 0) {
+    wait_until([&]() {
+      return io_staged_end - pos >= IO_ALIGN || io_closing || write_error;
+    });
+    if (write_error) {
+      break;
+    }
+    bool closing = io_closing;
+    uint64_t end = io_staged_end;
+    uint64_t aligned_end = end / IO_ALIGN * IO_ALIGN;
+    if (aligned_end > pos) {
+      // io_buffer_size is a multiple of IO_ALIGN, so this is aligned.
+      size_t offset = pos % io_buffer_size;
+      size_t length = min<uint64_t>(aligned_end - pos, io_buffer_size - offset);
+      if (!io_write(io_buffer + offset, length, pos)) {
         write_error = true;
+        notify();
+        break;
       }
-
-      // wait until we're the next thread that needs to write
-      while (!write_error) {
-        bool other_thread_write_first = false;
-        for (uint32_t i = 0; i < thread_pos.size(); ++i) {
-          if (thread_pos[i] < thread_pos[thread_index]) {
-            other_thread_write_first = true;
-          }
-        }
-        if (!other_thread_write_first) {
+      pos += length;
+      bytes_written += length;
+      io_written_pos = pos;
+      notify();
+      continue;
+    }
+    if (closing) {
+      if (end > pos) {
+        // Write the final partial block padded to IO_ALIGN, then trim the
+        // padding.
+        uint8_t* tail = io_buffer + pos % io_buffer_size;
+        memset(tail + (end - pos), 0, IO_ALIGN - (end - pos));
+        if (!io_write(tail, IO_ALIGN, pos) || ftruncate(fd, end) < 0) {
+          write_error = true;
           break;
         }
-        pthread_cond_wait(&cond, &mutex);
+        bytes_written += end - pos;
       }
-
-      if (!write_error) {
-        pthread_mutex_unlock(&mutex);
-        ::write(fd, &outputbuf[0],
-                sizeof(BlockHeader) + header->compressed_length);
-        pthread_mutex_lock(&mutex);
-      }
-
-      thread_pos[thread_index] = UINT64_MAX;
-      // do a broadcast because we might need to unblock
-      // the producer thread or a compressor thread waiting
-      // for us to write.
-      pthread_cond_broadcast(&cond);
-      continue;
-    }
-
-    if (closing && (write_error || next_thread_pos == next_thread_end_pos)) {
       break;
     }
-
-    pthread_cond_wait(&cond, &mutex);
   }
-
-  pthread_mutex_unlock(&mutex);
 }
 
 void CompressedWriter::close() {
@@ -204,51 +434,61 @@ void CompressedWriter::close() {
     return;
   }
 
-  update_reservation(NOWAIT);
-
-  pthread_mutex_lock(&mutex);
-  closing = true;
-  pthread_cond_broadcast(&cond);
-  pthread_mutex_unlock(&mutex);
+  if (producer_has_block && producer_fill > 0) {
+    publish_block();
+  }
+  end_ticket = producer_ticket;
+  notify();
 
   for (auto i = threads.begin(); i != threads.end(); ++i) {
     pthread_join(*i, nullptr);
   }
+  if (io_buffer) {
+    io_closing = true;
+    notify();
+    pthread_join(io_thread_handle, nullptr);
+  }
+  if (write_error) {
+    error = true;
+  }
 
   fd.close();
 }
 
-size_t CompressedWriter::do_compress(uint64_t offset, size_t length,
-                                     uint8_t* outputbuf, size_t outputbuf_len) {
+CompressedWriter::Stats CompressedWriter::stats() const {
+  Stats result;
+  result.uncompressed_bytes = uncompressed_bytes;
+  result.bytes_written = bytes_written;
+  result.producer_stall_sec = producer_stall_ns / 1e9;
+  result.write_stall_sec = write_stall_ns / 1e9;
+  result.queue_depth =
+      producer_ticket - next_write_ticket.load(memory_order_acquire);
+  result.max_queue_depth = max_queue_depth;
+  result.max_io_queue_bytes = max_io_queue_bytes;
+  result.level = level;
+  return result;
+}
+
+size_t CompressedWriter::do_compress(const uint8_t* data, size_t length,
+                                     int level, uint8_t* outputbuf,
+                                     size_t outputbuf_len) {
   z_stream stream;
   memset(&stream, 0, sizeof(stream));
-  int result = deflateInit(&stream, Z_DEFAULT_COMPRESSION);
+  int result = deflateInit(&stream, level);
   if (result != Z_OK) {
     assert(0 && "deflateInit failed!");
     return 0;
   }
 
+  stream.next_in = const_cast<uint8_t*>(data);
+  stream.avail_in = length;
   stream.next_out = outputbuf;
   stream.avail_out = outputbuf_len;
 
-  while (length > 0 || stream.avail_in > 0) {
-    if (stream.avail_in == 0) {
-      size_t buf_offset = (size_t)(offset % buffer.size());
-      size_t amount = min(length, buffer.size() - buf_offset);
-      stream.next_in = &buffer[buf_offset];
-      stream.avail_in = amount;
-      length -= amount;
-      offset += amount;
-    }
-    if (stream.avail_out == 0) {
-      assert(0 && "outputbuf exhausted!");
-      return 0;
-    }
-    result = deflate(&stream, length == 0 ? Z_FINISH : Z_NO_FLUSH);
-    if (result != (length == 0 ? Z_STREAM_END : Z_OK)) {
-      assert(0 && "deflate failed!");
-      return 0;
-    }
+  result = deflate(&stream, Z_FINISH);
+  if (result != Z_STREAM_END) {
+    assert(0 && "deflate failed!");
+    return 0;
   }
 
   result = deflateEnd(&stream);
@@ -6,6 +6,7 @@
 #include <pthread.h>
 #include <stdint.h>
 
+#include <atomic>
 #include <memory>
 #include <vector>
 #include <string>
@@ -16,7 +17,8 @@ namespace rr {
 
 /**
  * CompressedWriter opens an output file and writes compressed blocks to it.
- * Blocks of a fixed but unspecified size (currently 1MB) are compressed.
+ * Blocks of a variable size (at most the 'block_size' passed to the
+ * constructor) are compressed.
  * Each block of compressed data is written to the file preceded by two
  * 32-bit words: the size of the compressed data (excluding block header)
  * and the size of the uncompressed data, in that order. See BlockHeader below.
@@ -24,15 +26,50 @@ namespace rr {
  * We use multiple threads to perform compression. The threads are
  * responsible for the actual data writes. The thread that creates the
  * CompressedWriter is the "producer" thread and must also be the caller of
- * 'write'. The producer thread may block in 'write' if 'buffer_size' bytes are
+ * 'write'. The producer thread may block in 'write' if all blocks are
  * being compressed.
  *
+ * The producer and the compression threads share a ring of blocks without
+ * taking locks. Blocks are handed out in "ticket" order: the producer fills
+ * the block for ticket N and publishes it, a compression thread claims
+ * ticket N, compresses the block, waits until ticket N-1 has been written,
+ * writes its output and then frees the block for ticket N + ring size.
+ * Threads only enter the kernel (via futex) when they actually have to wait.
+ *
+ * The producer adapts the size of the blocks it publishes: when it stalls
+ * because all blocks are busy, it halves the block size so that compression
+ * threads free ring space in smaller increments; when it publishes a block
+ * while all compression threads are idle, it doubles the block size back
+ * towards the maximum, which gives the best compression ratio.
+ *
+ * The producer also picks the zlib level for each block it publishes, within
+ * the [min_level, max_level] bounds passed to the constructor: a stall drops
+ * straight to min_level, a backlog of more than half the ring lowers the
+ * level one step at a time, and publishing while the compression threads are
+ * idle raises it one step, unless the data has recently been
+ * incompressible, in which case higher levels would only burn CPU and we
+ * step down towards level 1 (never 0, so we keep measuring the ratio).
+ * The level used for each block is recorded in its header.
+ *
+ * In ASYNC_DIRECT_IO mode, compression threads don't write to the file
+ * themselves. They append their output to a staging buffer which a
+ * dedicated I/O thread flushes with aligned O_DIRECT writes (falling back to
+ * buffered writes if the filesystem doesn't support O_DIRECT), so
+ * compression overlaps with I/O.
+ *
  * Each data block is compressed independently using zlib.
  */
 class CompressedWriter {
 public:
+  enum IoMode { BLOCKING_IO, ASYNC_DIRECT_IO };
+
+  // zlib's default level
+  static const int DEFAULT_LEVEL = 6;
+
   CompressedWriter(const std::string& filename, size_t buffer_size,
-                   uint32_t num_threads);
+                   uint32_t num_threads, IoMode io_mode = BLOCKING_IO,
+                   int min_level = DEFAULT_LEVEL,
+                   int max_level = DEFAULT_LEVEL);
   ~CompressedWriter();
   // Call only on producer thread
   bool good() const { return !error; }
@@ -44,8 +81,36 @@ public:
   struct BlockHeader {
     uint32_t compressed_length;
     uint32_t uncompressed_length;
+    /* zlib level the block was compressed with */
+    uint32_t compression_level;
   };
 
+  struct Stats {
+    /* Bytes passed to write() */
+    uint64_t uncompressed_bytes;
+    /* Compressed bytes (including block headers) written to the file */
+    uint64_t bytes_written;
+    /* Time the producer spent waiting for a free block */
+    double producer_stall_sec;
+    /* Time compression threads spent blocked writing their output, or
+     * waiting for space in the I/O thread's staging buffer */
+    double write_stall_sec;
+    /* Number of blocks currently published but not yet written */
+    uint64_t queue_depth;
+    /* Maximum number of blocks published but not yet written */
+    uint64_t max_queue_depth;
+    /* Maximum number of bytes staged for the I/O thread but not yet
+     * written */
+    uint64_t max_io_queue_bytes;
+    /* zlib level the next block will be compressed with */
+    int level;
+  };
+  // Call only on producer thread
+  Stats stats() const;
+  // Call only on producer thread. The uncompressed offset of the next byte
+  // to be written, i.e. the number of bytes passed to write() so far.
+  uint64_t position() const { return uncompressed_bytes; }
+
   template <typename T> CompressedWriter& operator<<(const T& value) {
     write(&value, sizeof(value));
     return *this;
@@ -66,41 +131,94 @@ public:
   }
 
 protected:
-  enum WaitFlag { WAIT, NOWAIT };
-  void update_reservation(WaitFlag wait_flag);
+  struct Block {
+    Block() : seq(0), length(0), level(DEFAULT_LEVEL) {}
+    /* If equal to ticket N, this block is free for the producer to fill
+     * with the data for ticket N. If equal to N + 1, it holds the data for
+     * ticket N, ready to be compressed. */
+    std::atomic<uint64_t> seq;
+    /* Set by the producer before publishing the block */
+    size_t length;
+    int level;
+    std::unique_ptr<uint8_t[]> data;
+  };
+
+  void acquire_block();
+  void publish_block();
+  bool recently_incompressible();
+  template <typename Predicate> void wait_until(Predicate pred);
+  void notify();
 
   static void* compression_thread_callback(void* p);
   void compression_thread();
-  size_t do_compress(uint64_t offset, size_t length, uint8_t* outputbuf,
-                     size_t outputbuf_len);
+  void write_output(const uint8_t* data, size_t length);
+  static void* io_thread_callback(void* p);
+  void io_thread();
+  bool io_write(const uint8_t* data, size_t length, uint64_t offset);
+  size_t do_compress(const uint8_t* data, size_t length, int level,
+                     uint8_t* outputbuf, size_t outputbuf_len);
 
   // Immutable while threads are running
   ScopedFd fd;
-  int block_size;
-  pthread_mutex_t mutex;
-  pthread_cond_t cond;
+  size_t max_block_size;
+  size_t min_block_size;
+  size_t num_blocks;
+  int min_level;
+  int max_level;
+  std::unique_ptr<Block[]> blocks;
   std::vector<pthread_t> threads;
-
-  // Carefully shared...
-  std::vector<uint8_t> buffer;
-
-  // BEGIN protected by 'mutex'
-  /* position in output stream that this thread is currently working on,
-   * or UINT64_MAX if it's idle */
-  std::vector<uint64_t> thread_pos;
-  /* position in output stream of data to dispatch to next thread */
-  uint64_t next_thread_pos;
-  /* position in output stream of end of data ready to dispatch */
-  uint64_t next_thread_end_pos;
-  bool closing;
-  bool write_error;
-  // END protected by 'mutex'
+  IoMode io_mode;
+  /* ASYNC_DIRECT_IO only: staging ring, aligned for O_DIRECT */
+  uint8_t* io_buffer;
+  size_t io_buffer_size;
+  pthread_t io_thread_handle;
+
+  // Shared between all threads
+  /* next ticket for a compression thread to claim */
+  std::atomic<uint64_t> next_compress_ticket;
+  /* ticket of the next block to be written to the file */
+  std::atomic<uint64_t> next_write_ticket;
+  /* one past the last ticket the producer will publish, or UINT64_MAX
+   * while we're not closing */
+  std::atomic<uint64_t> end_ticket;
+  std::atomic<bool> write_error;
+  /* Futex word, incremented whenever waiting threads might make progress */
+  std::atomic<uint32_t> wake_seq;
+  /* Number of threads that might be waiting on 'wake_seq' */
+  std::atomic<int> waiters;
+  /* ASYNC_DIRECT_IO only: file offset of the end of the staged data and
+   * of the data the I/O thread has written. Staging is done by the
+   * compression thread whose turn it is to write. */
+  std::atomic<uint64_t> io_staged_end;
+  std::atomic<uint64_t> io_written_pos;
+  /* Set once all data has been staged */
+  std::atomic<bool> io_closing;
+  std::atomic<uint64_t> bytes_written;
+  /* Totals over all blocks compressed at a level above 0, which the
+   * producer samples to estimate the current compression ratio */
+  std::atomic<uint64_t> compressed_in_bytes;
+  std::atomic<uint64_t> compressed_out_bytes;
+  std::atomic<uint64_t> write_stall_ns;
+  std::atomic<uint64_t> max_io_queue_bytes;
 
   /* producer thread only */
-  /* Areas in the buffer that have been reserved for write() */
-  uint64_t producer_reserved_pos;
-  uint64_t producer_reserved_write_pos;
-  uint64_t producer_reserved_upto_pos;
+  /* ticket of the block the producer is filling */
+  uint64_t producer_ticket;
+  /* number of bytes written to that block, if producer_has_block */
+  size_t producer_fill;
+  bool producer_has_block;
+  /* size at which the producer publishes a block */
+  size_t target_block_size;
+  /* zlib level for the next block the producer publishes */
+  int level;
+  /* compressed_in_bytes and compressed_out_bytes when we last sampled
+   * them */
+  uint64_t sampled_in_bytes;
+  uint64_t sampled_out_bytes;
+  bool sampled_incompressible;
+  uint64_t uncompressed_bytes;
+  uint64_t producer_stall_ns;
+  uint64_t max_queue_depth;
   bool error;
 };
 
@@ -4,6 +4,7 @@
 #include <inttypes.h>
 
 #include <limits>
+#include <set>
 
 #include "preload/preload_interface.h"
 
@@ -34,13 +35,19 @@ DumpCommand DumpCommand::singleton(
     "  Event specs can be either an event number like `127', or a range\n"
     "  like `1000-5000'.  By default, all events are dumped.\n"
     "  -b, --syscallbuf           dump syscallbuf contents\n"
+    "  -e, --event=<TYPE>         only dump events of type <TYPE> (e.g.\n"
+    "                             SYSCALL or SCHED); may be repeated\n"
     " --g, --generic              dump generic data\n"
+    "  -j, --json                 dump each event as a JSON object on a\n"
+    "                             single line\n"
     "  -m, --recorded-metadata    dump recorded data metadata\n"
     "  -p, --mmaps                dump mmap data\n"
     "  -r, --raw                  dump trace frames in a more easily\n"
     "                             machine-parseable format instead of the\n"
     "                             default human-readable format\n"
-    "  -s, --statistics           dump statistics about the trace\n");
+    "  -s, --statistics           dump statistics about the trace\n"
+    "  -t, --tid=<TID>            only dump events of thread <TID>; may be\n"
+    "                             repeated\n");
 
 struct DumpFlags {
   bool dump_syscallbuf;
@@ -48,7 +55,12 @@ struct DumpFlags {
   bool dump_recorded_data_metadata;
   bool dump_mmaps;
   bool raw_dump;
+  bool json_dump;
   bool dump_statistics;
+  // If nonempty, only dump events for these tids
+  set<pid_t> only_tids;
+  // If nonempty, only dump events with these type names
+  set<string> only_event_types;
 
   DumpFlags()
       : dump_syscallbuf(false),
@@ -56,6 +68,7 @@ struct DumpFlags {
         dump_recorded_data_metadata(false),
         dump_mmaps(false),
         raw_dump(false),
+        json_dump(false),
         dump_statistics(false) {}
 };
 
@@ -66,11 +79,14 @@ static bool parse_dump_arg(std::vector<std::string>& args, DumpFlags& flags) {
 
   static const OptionSpec options[] = {
     { 'b', "syscallbuf", NO_PARAMETER },
+    { 'e', "event", HAS_PARAMETER },
     { 'g', "generic", NO_PARAMETER },
+    { 'j', "json", NO_PARAMETER },
     { 'm', "recorded-metadata", NO_PARAMETER },
     { 'p', "mmaps", NO_PARAMETER },
     { 'r', "raw", NO_PARAMETER },
-    { 's', "statistics", NO_PARAMETER }
+    { 's', "statistics", NO_PARAMETER },
+    { 't', "tid", HAS_PARAMETER }
   };
   ParsedOption opt;
   if (!Command::parse_option(args, options, &opt)) {
@@ -81,9 +97,15 @@ static bool parse_dump_arg(std::vector<std::string>& args, DumpFlags& flags) {
     case 'b':
       flags.dump_syscallbuf = true;
       break;
+    case 'e':
+      flags.only_event_types.insert(opt.value);
+      break;
     case 'g':
       flags.dump_generic = true;
       break;
+    case 'j':
+      flags.json_dump = true;
+      break;
     case 'm':
       flags.dump_recorded_data_metadata = true;
       break;
@@ -96,14 +118,75 @@ static bool parse_dump_arg(std::vector<std::string>& args, DumpFlags& flags) {
     case 's':
       flags.dump_statistics = true;
       break;
+    case 't':
+      if (!opt.verify_valid_int(1, INT32_MAX)) {
+        return false;
+      }
+      flags.only_tids.insert(opt.int_value);
+      break;
     default:
       assert(0 && "Unknown option");
   }
   return true;
 }
 
-static void dump_syscallbuf_data(TraceReader& trace, FILE* out,
-                                 const TraceFrame& frame) {
+static string json_string(const string& s) {
+  string result = "\"";
+  for (char c : s) {
+    switch (c) {
+      case '"':
+        result += "\\\"";
+        break;
+      case '\\':
+        result += "\\\\";
+        break;
+      default:
+        if ((unsigned char)c < 0x20) {
+          char buf[8];
+          sprintf(buf, "\\u%04x", c);
+          result += buf;
+        } else {
+          result += c;
+        }
+        break;
+    }
+  }
+  return result + "\"";
+}
+
+/**
+ * Prints the records attached to a frame, either one per line in the
+ * human-readable format or as a JSON array member of the frame's object.
+ */
+class RecordPrinter {
+public:
+  RecordPrinter(FILE* out, bool json, const char* name)
+      : out(out), json(json), name(name), count(0) {}
+  ~RecordPrinter() {
+    if (json && count) {
+      fputc(']', out);
+    }
+  }
+  /* Start a record. The caller prints its fields. */
+  void begin() {
+    if (json) {
+      fprintf(out, count ? ",{" : ",\"%s\":[{", name);
+    } else {
+      fputs("  { ", out);
+    }
+    ++count;
+  }
+  void end() { fputs(json ? "}" : " }\n", out); }
+
+private:
+  FILE* out;
+  bool json;
+  const char* name;
+  int count;
+};
+
+static void dump_syscallbuf_data(TraceReader& trace, const DumpFlags& flags,
+                                 FILE* out, const TraceFrame& frame) {
   if (frame.event().type() != EV_SYSCALLBUF_FLUSH) {
     return;
   }
@@ -116,13 +199,22 @@ static void dump_syscallbuf_data(TraceReader& trace, FILE* out,
   }
   bytes_remaining = flush_hdr->num_rec_bytes;
 
+  RecordPrinter printer(out, flags.json_dump, "syscallbuf");
   auto record_ptr = reinterpret_cast<const uint8_t*>(flush_hdr + 1);
   auto end_ptr = record_ptr + bytes_remaining;
   while (record_ptr < end_ptr) {
     auto record = reinterpret_cast<const struct syscallbuf_record*>(record_ptr);
-    fprintf(out, "  { syscall:'%s', ret:0x%lx, size:0x%lx }\n",
-            syscall_name(record->syscallno, frame.event().arch()).c_str(),
-            (long)record->ret, (long)record->size);
+    string name = syscall_name(record->syscallno, frame.event().arch());
+    printer.begin();
+    if (flags.json_dump) {
+      fprintf(out, "\"syscall\":%s,\"ret\":%ld,\"size\":%ld",
+              json_string(name).c_str(), (long)record->ret,
+              (long)record->size);
+    } else {
+      fprintf(out, "syscall:'%s', ret:0x%lx, size:0x%lx", name.c_str(),
+              (long)record->ret, (long)record->size);
+    }
+    printer.end();
     if (record->size < sizeof(*record)) {
       fprintf(stderr, "Malformed trace file (bad record size)\n");
       abort();
@@ -131,6 +223,78 @@ static void dump_syscallbuf_data(TraceReader& trace, FILE* out,
   }
 }
 
+static void dump_frame_json(FILE* out, const TraceFrame& frame) {
+  const Event& ev = frame.event();
+  fprintf(out, "{\"global_time\":%u,\"real_time\":%f,\"tid\":%d,"
+               "\"event\":%s,\"type\":%s,",
+          frame.time(), frame.monotonic_time(), frame.tid(),
+          json_string(ev.str()).c_str(), json_string(ev.type_name()).c_str());
+  if (ev.is_syscall_event()) {
+    fprintf(out, "\"state\":\"%s\",", state_name(ev.Syscall().state));
+  }
+  fprintf(out, "\"ticks\":%" PRId64, frame.ticks());
+  if (ev.has_exec_info() == HAS_EXEC_INFO) {
+    fprintf(out, ",\"ip\":\"0x%llx\"",
+            (unsigned long long)frame.regs().ip().register_value());
+  }
+}
+
+static void dump_mapped_regions(TraceReader& trace, const DumpFlags& flags,
+                                FILE* out) {
+  RecordPrinter printer(out, flags.json_dump, "mmaps");
+  while (true) {
+    TraceReader::MappedData data;
+    bool found;
+    KernelMapping km = trace.read_mapped_region(&data, &found);
+    if (!found) {
+      break;
+    }
+    if (!flags.dump_mmaps) {
+      continue;
+    }
+    char prot_flags[] = "rwxp";
+    if (!(km.prot() & PROT_READ)) {
+      prot_flags[0] = '-';
+    }
+    if (!(km.prot() & PROT_WRITE)) {
+      prot_flags[1] = '-';
+    }
+    if (!(km.prot() & PROT_EXEC)) {
+      prot_flags[2] = '-';
+    }
+    if (km.flags() & MAP_SHARED) {
+      prot_flags[3] = 's';
+    }
+    printer.begin();
+    if (flags.json_dump) {
+      fprintf(out, "\"map_file\":%s,\"addr\":\"0x%llx\",\"length\":%llu,"
+                   "\"prot_flags\":\"%s\",\"file_offset\":%llu,"
+                   "\"data_file\":%s,\"data_offset\":%llu",
+              json_string(km.fsname()).c_str(),
+              (unsigned long long)km.start().as_int(),
+              (unsigned long long)km.size(), prot_flags,
+              (unsigned long long)km.file_offset_bytes(),
+              json_string(data.file_name).c_str(),
+              (unsigned long long)data.file_data_offset_bytes);
+    } else {
+      fprintf(out, "map_file:\"%s\", addr:%p, length:%p, "
+                   "prot_flags:\"%s\", file_offset:0x%llx, "
+                   "data_file:\"%s\", data_offset:0x%llx",
+              km.fsname().c_str(), (void*)km.start().as_int(),
+              (void*)km.size(), prot_flags, (long long)km.file_offset_bytes(),
+              data.file_name.c_str(), (long long)data.file_data_offset_bytes);
+    }
+    printer.end();
+  }
+}
+
+static bool frame_matches(const DumpFlags& flags, pid_t tid,
+                          const Event& ev) {
+  return (flags.only_tids.empty() || flags.only_tids.count(tid)) &&
+         (flags.only_event_types.empty() ||
+          flags.only_event_types.count(ev.type_name()));
+}
+
 /**
  * Dump all events from the current to trace that match |spec| to
  * |out|.  |spec| has the following syntax: /\d+(-\d+)?/, expressing
@@ -142,6 +306,9 @@ static void dump_syscallbuf_data(TraceReader& trace, FILE* out,
  * constructed so as to match properly on a serial linear scan; that
  * is, they should comprise disjoint and monotonically increasing
  * event sets.  No attempt is made to enforce this or normalize specs.
+ *
+ * When the trace has a frame index, frames outside the range or rejected
+ * by the tid/event filters are skipped without reading any of their data.
  */
 static void dump_events_matching(TraceReader& trace, const DumpFlags& flags,
                                  FILE* out, const string* spec) {
@@ -155,66 +322,100 @@ static void dump_events_matching(TraceReader& trace, const DumpFlags& flags,
     start = end = atoi(spec->c_str());
   }
 
+  // Skip straight to the first event we want, if the trace is indexed.
+  // Otherwise we scan forward to it.
+  if (start > trace.time() + 1) {
+    trace.seek_to_frame(start);
+  }
+
   bool process_raw_data =
       flags.dump_syscallbuf || flags.dump_recorded_data_metadata;
-  while (!trace.at_end()) {
-    auto frame = trace.read_frame();
-    if (end < frame.time()) {
-      return;
+  bool use_index = !flags.only_tids.empty() || !flags.only_event_types.empty();
+  // True when we've skipped frames using the index, so the trace is
+  // positioned before |next_time|.
+  bool skipped = false;
+  TraceFrame::Time next_time = trace.time() + 1;
+  while (next_time <= end) {
+    if (use_index) {
+      TraceReader::FrameIndexEntry entry;
+      if (trace.read_frame_index(next_time, &entry)) {
+        if (!frame_matches(flags, entry.tid, Event(entry.event))) {
+          skipped = true;
+          ++next_time;
+          continue;
+        }
+        if (skipped) {
+          // If the index entry is stale we're still before the frames we
+          // skipped; scan forward over them instead.
+          if (!trace.seek_to_frame(next_time)) {
+            use_index = false;
+          }
+          skipped = false;
+        }
+      } else {
+        // No index, or it ends early because recording was cut short.
+        // Go back to the last frame we skipped and scan from there.
+        if (skipped) {
+          trace.seek_to_frame(next_time - 1);
+          skipped = false;
+        }
+        use_index = false;
+      }
     }
-    if (start <= frame.time() && frame.time() <= end) {
-      if (flags.raw_dump) {
+    if (trace.at_end()) {
+      break;
+    }
+
+    auto frame = trace.read_frame();
+    next_time = frame.time() + 1;
+    if (start <= frame.time() &&
+        frame_matches(flags, frame.tid(), frame.event())) {
+      if (flags.json_dump) {
+        dump_frame_json(out, frame);
+      } else if (flags.raw_dump) {
         frame.dump_raw(out);
       } else {
         frame.dump(out);
       }
       if (flags.dump_syscallbuf) {
-        dump_syscallbuf_data(trace, out, frame);
+        dump_syscallbuf_data(trace, flags, out, frame);
       }
 
-      while (true) {
-        TraceReader::MappedData data;
-        bool found;
-        KernelMapping km = trace.read_mapped_region(&data, &found);
-        if (!found) {
-          break;
-        }
-        if (flags.dump_mmaps) {
-          char prot_flags[] = "rwxp";
-          if (!(km.prot() & PROT_READ)) {
-            prot_flags[0] = '-';
-          }
-          if (!(km.prot() & PROT_WRITE)) {
-            prot_flags[1] = '-';
-          }
-          if (!(km.prot() & PROT_EXEC)) {
-            prot_flags[2] = '-';
+      dump_mapped_regions(trace, flags, out);
+
+      {
+        RecordPrinter printer(out, flags.json_dump, "data");
+        TraceReader::RawData data;
+        while (process_raw_data && trace.read_raw_data_for_frame(frame, data)) {
+          if (flags.dump_recorded_data_metadata) {
+            printer.begin();
+            if (flags.json_dump) {
+              fprintf(out, "\"addr\":\"0x%llx\",\"length\":%zu",
+                      (unsigned long long)data.addr.as_int(), data.data.size());
+            } else {
+              fprintf(out, "addr:%p, length:%p", (void*)data.addr.as_int(),
+                      (void*)data.data.size());
+            }
+            printer.end();
           }
-          if (km.flags() & MAP_SHARED) {
-            prot_flags[3] = 's';
-          }
-          fprintf(out, "  { map_file:\"%s\", addr:%p, length:%p, "
-                       "prot_flags:\"%s\", file_offset:0x%llx, "
-                       "data_file:\"%s\", data_offset:0x%llx }\n",
-                  km.fsname().c_str(), (void*)km.start().as_int(),
-                  (void*)km.size(), prot_flags,
-                  (long long)km.file_offset_bytes(), data.file_name.c_str(),
-                  (long long)data.file_data_offset_bytes);
         }
       }
-
-      TraceReader::RawData data;
-      while (process_raw_data && trace.read_raw_data_for_frame(frame, data)) {
-        if (flags.dump_recorded_data_metadata) {
-          fprintf(out, "  { addr:%p, length:%p }\n", (void*)data.addr.as_int(),
-                  (void*)data.data.size());
+      {
+        RecordPrinter printer(out, flags.json_dump, "generic");
+        vector<uint8_t> buf;
+        while (flags.dump_generic && trace.read_generic_for_frame(frame, buf)) {
+          printer.begin();
+          if (flags.json_dump) {
+            fprintf(out, "\"length\":%zu", buf.size());
+          } else {
+            fprintf(out, "length:%p", (void*)buf.size());
+          }
+          printer.end();
         }
       }
-      vector<uint8_t> buf;
-      while (flags.dump_generic && trace.read_generic_for_frame(frame, buf)) {
-        fprintf(out, "  { length:%p }\n", (void*)buf.size());
-      }
-      if (!flags.raw_dump) {
+      if (flags.json_dump) {
+        fputs("}\n", out);
+      } else if (!flags.raw_dump) {
         fprintf(out, "}\n");
       }
     } else {
@@ -228,6 +429,9 @@ static void dump_events_matching(TraceReader& trace, const DumpFlags& flags,
           break;
         }
       }
+      vector<uint8_t> buf;
+      while (flags.dump_generic && trace.read_generic_for_frame(frame, buf)) {
+      }
     }
   }
 }
@@ -238,6 +442,15 @@ static void dump_statistics(const TraceReader& trace, FILE* out) {
   fprintf(out, "// Uncompressed bytes %" PRIu64 ", compressed bytes %" PRIu64
                ", ratio %.2fx\n",
           uncompressed, compressed, double(uncompressed) / compressed);
+  for (int s = TraceStream::SUBSTREAM_FIRST; s < TraceStream::SUBSTREAM_COUNT;
+       ++s) {
+    fprintf(out, "// %s blocks by compression level:",
+            TraceStream::substream_name((TraceStream::Substream)s));
+    for (auto& l : trace.compression_levels((TraceStream::Substream)s)) {
+      fprintf(out, " %u:%" PRIu64, l.first, l.second);
+    }
+    fprintf(out, "\n");
+  }
 }
 
 static void dump(const string& trace_dir, const DumpFlags& flags,
@@ -0,0 +1,871 @@
+/* -*- Mode: C++; tab-width: 8; c-basic-offset: 2; indent-tabs-mode: nil; -*- */
+
+//#define DEBUGTAG "EhFrameUnwinder"
+
+#include "EhFrameUnwinder.h"
+
+#include <elf.h>
+#include <string.h>
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "AddressSpace.h"
+#include "log.h"
+#include "Task.h"
+
+using namespace std;
+
+namespace rr {
+
+// Pointer encodings used in .eh_frame and .eh_frame_hdr; see the LSB
+// "Exception Frames" specification.
+enum {
+  DW_EH_PE_absptr = 0x00,
+  DW_EH_PE_uleb128 = 0x01,
+  DW_EH_PE_udata2 = 0x02,
+  DW_EH_PE_udata4 = 0x03,
+  DW_EH_PE_udata8 = 0x04,
+  DW_EH_PE_sleb128 = 0x09,
+  DW_EH_PE_sdata2 = 0x0a,
+  DW_EH_PE_sdata4 = 0x0b,
+  DW_EH_PE_sdata8 = 0x0c,
+  DW_EH_PE_pcrel = 0x10,
+  DW_EH_PE_datarel = 0x30,
+  DW_EH_PE_indirect = 0x80,
+  DW_EH_PE_omit = 0xff
+};
+
+// Call frame instructions; see the DWARF 4 specification, section 6.4.2.
+enum {
+  DW_CFA_advance_loc = 0x40,
+  DW_CFA_offset = 0x80,
+  DW_CFA_restore = 0xc0,
+  DW_CFA_nop = 0x00,
+  DW_CFA_set_loc = 0x01,
+  DW_CFA_advance_loc1 = 0x02,
+  DW_CFA_advance_loc2 = 0x03,
+  DW_CFA_advance_loc4 = 0x04,
+  DW_CFA_offset_extended = 0x05,
+  DW_CFA_restore_extended = 0x06,
+  DW_CFA_undefined = 0x07,
+  DW_CFA_same_value = 0x08,
+  DW_CFA_register = 0x09,
+  DW_CFA_remember_state = 0x0a,
+  DW_CFA_restore_state = 0x0b,
+  DW_CFA_def_cfa = 0x0c,
+  DW_CFA_def_cfa_register = 0x0d,
+  DW_CFA_def_cfa_offset = 0x0e,
+  DW_CFA_def_cfa_expression = 0x0f,
+  DW_CFA_expression = 0x10,
+  DW_CFA_offset_extended_sf = 0x11,
+  DW_CFA_def_cfa_sf = 0x12,
+  DW_CFA_def_cfa_offset_sf = 0x13,
+  DW_CFA_val_offset = 0x14,
+  DW_CFA_val_offset_sf = 0x15,
+  DW_CFA_val_expression = 0x16,
+  DW_CFA_GNU_args_size = 0x2e,
+  DW_CFA_GNU_negative_offset_extended = 0x2f
+};
+
+/**
+ * DWARF register numbers of the registers we track while unwinding.
+ */
+template <typename Arch> struct DwarfRegs;
+template <> struct DwarfRegs<X86Arch> {
+  enum { SP = 4, BP = 5 };
+};
+template <> struct DwarfRegs<X64Arch> {
+  enum { SP = 7, BP = 6 };
+};
+
+/**
+ * Bounds-checked reader for DWARF data copied out of the tracee. |vaddr|
+ * is the link-time address of the first byte, needed to decode pc-relative
+ * pointers. Reading past the end sets the error flag and returns zeroes.
+ */
+class DwarfReader {
+public:
+  DwarfReader(const vector<uint8_t>& data, uintptr_t vaddr, size_t word_size)
+      : data(data),
+        base_vaddr(vaddr),
+        word_size(word_size),
+        pos(0),
+        end(data.size()),
+        ok_(true) {}
+
+  bool ok() const { return ok_; }
+  bool at_end() const { return pos >= end; }
+  uintptr_t vaddr() const { return base_vaddr + pos; }
+  size_t offset() const { return pos; }
+  void set_range(size_t start, size_t new_end) {
+    if (start > new_end || new_end > data.size()) {
+      ok_ = false;
+      return;
+    }
+    pos = start;
+    end = new_end;
+  }
+  void skip(size_t n) {
+    if (n > end - pos) {
+      ok_ = false;
+      pos = end;
+      return;
+    }
+    pos += n;
+  }
+
+  template <typename T> T read() {
+    T v;
+    if (sizeof(T) > end - pos) {
+      ok_ = false;
+      pos = end;
+      return 0;
+    }
+    memcpy(&v, data.data() + pos, sizeof(T));
+    pos += sizeof(T);
+    return v;
+  }
+  uint64_t read_uleb() {
+    uint64_t v = 0;
+    int shift = 0;
+    while (true) {
+      uint8_t b = read<uint8_t>();
+      if (!ok_) {
+        return 0;
+      }
+      if (shift < 64) {
+        v |= uint64_t(b & 0x7f) << shift;
+      }
+      shift += 7;
+      if (!(b & 0x80)) {
+        return v;
+      }
+    }
+  }
+  int64_t read_sleb() {
+    int64_t v = 0;
+    int shift = 0;
+    uint8_t b;
+    do {
+      b = read<uint8_t>();
+      if (!ok_) {
+        return 0;
+      }
+      if (shift < 64) {
+        v |= int64_t(b & 0x7f) << shift;
+      }
+      shift += 7;
+    } while (b & 0x80);
+    if (shift < 64 && (b & 0x40)) {
+      v |= -(int64_t(1) << shift);
+    }
+    return v;
+  }
+  /**
+   * Read a pointer encoded with |encoding| (a DW_EH_PE_* value). Only
+   * absolute and pc-relative pointers are supported.
+   */
+  uintptr_t read_encoded(uint8_t encoding) {
+    if (encoding == DW_EH_PE_omit) {
+      return 0;
+    }
+    uintptr_t field_vaddr = vaddr();
+    uint64_t v;
+    switch (encoding & 0x0f) {
+      case DW_EH_PE_absptr:
+        v = word_size == 4 ? read<uint32_t>() : read<uint64_t>();
+        break;
+      case DW_EH_PE_uleb128:
+        v = read_uleb();
+        break;
+      case DW_EH_PE_udata2:
+        v = read<uint16_t>();
+        break;
+      case DW_EH_PE_udata4:
+        v = read<uint32_t>();
+        break;
+      case DW_EH_PE_udata8:
+        v = read<uint64_t>();
+        break;
+      case DW_EH_PE_sleb128:
+        v = read_sleb();
+        break;
+      case DW_EH_PE_sdata2:
+        v = int64_t(read<int16_t>());
+        break;
+      case DW_EH_PE_sdata4:
+        v = int64_t(read<int32_t>());
+        break;
+      case DW_EH_PE_sdata8:
+        v = read<int64_t>();
+        break;
+      default:
+        ok_ = false;
+        return 0;
+    }
+    switch (encoding & 0x70) {
+      case DW_EH_PE_absptr:
+        break;
+      case DW_EH_PE_pcrel:
+        v += field_vaddr;
+        break;
+      default:
+        ok_ = false;
+        return 0;
+    }
+    if (encoding & DW_EH_PE_indirect) {
+      ok_ = false;
+      return 0;
+    }
+    return word_size == 4 ? uint32_t(v) : v;
+  }
+
+private:
+  const vector<uint8_t>& data;
+  uintptr_t base_vaddr;
+  size_t word_size;
+  size_t pos;
+  size_t end;
+  bool ok_;
+};
+
+/**
+ * How to find the caller's value of a register we track.
+ */
+struct RegRule {
+  enum Kind {
+    // The register wasn't changed by this frame.
+    SAME,
+    // The register is saved at CFA + |offset|.
+    SAVED_AT_CFA_OFFSET,
+    // Any other rule (expressions, other registers, undefined).
+    UNSUPPORTED
+  };
+  RegRule(Kind kind = SAME, int64_t offset = 0) : kind(kind), offset(offset) {}
+  Kind kind;
+  int64_t offset;
+};
+
+struct CfiState {
+  CfiState() : cfa_reg(-1), cfa_offset(0), cfa_supported(true) {}
+  int cfa_reg;
+  int64_t cfa_offset;
+  bool cfa_supported;
+  RegRule ra;
+  RegRule bp;
+};
+
+struct Cie {
+  uint64_t code_align;
+  int64_t data_align;
+  uint64_t ra_reg;
+  uint8_t fde_encoding;
+  bool has_augmentation_data;
+  vector<uint8_t> data;
+  uintptr_t vaddr;
+  size_t insns_start;
+  size_t insns_end;
+};
+
+/**
+ * How to unwind from one code address: the result of running the CFI
+ * program up to that address, reduced to what we need.
+ */
+struct FrameRule {
+  FrameRule()
+      : valid(false),
+        cfa_is_bp(false),
+        cfa_offset(0),
+        ra_offset(0),
+        bp_saved(false),
+        bp_offset(0) {}
+  bool valid;
+  // CFA = SP (or BP if |cfa_is_bp|) + |cfa_offset|.
+  bool cfa_is_bp;
+  int64_t cfa_offset;
+  // The return address is saved at CFA + |ra_offset|.
+  int64_t ra_offset;
+  // If |bp_saved|, the caller's BP is saved at CFA + |bp_offset|, otherwise
+  // BP is unchanged.
+  bool bp_saved;
+  int64_t bp_offset;
+};
+
+struct UnwindObjectKey {
+  UnwindObjectKey(const KernelMapping& m)
+      : fsname(m.fsname()), device(m.device()), inode(m.inode()) {}
+  bool operator<(const UnwindObjectKey& other) const {
+    return tie(device, inode, fsname) <
+           tie(other.device, other.inode, other.fsname);
+  }
+  string fsname;
+  dev_t device;
+  ino_t inode;
+};
+
+/**
+ * Cached unwind data for one ELF object. All addresses are link-time
+ * addresses; the load bias of each mapping is computed separately.
+ */
+struct UnwindObject {
+  UnwindObject() : loaded(false), valid(false), link_base(0) {}
+  bool loaded;
+  bool valid;
+  // Link-time address that file offset 0 is loaded at.
+  uintptr_t link_base;
+  // The .eh_frame_hdr binary search table: (initial pc, FDE address) pairs
+  // sorted by pc.
+  vector<pair<uintptr_t, uintptr_t> > fdes;
+  // FrameRules already computed, indexed by pc.
+  map<uintptr_t, FrameRule> rules;
+  // Load bias, indexed by (mapping start, file offset) of mappings of this
+  // object we've seen.
+  map<pair<uintptr_t, uint64_t>, uintptr_t> biases;
+};
+
+struct EhFrameUnwinder::Cache {
+  map<UnwindObjectKey, UnwindObject> objects;
+};
+
+EhFrameUnwinder::EhFrameUnwinder() : cache(new Cache()) {}
+
+EhFrameUnwinder::EhFrameUnwinder(const EhFrameUnwinder& other)
+    : cache(new Cache(*other.cache)) {}
+
+EhFrameUnwinder::~EhFrameUnwinder() {}
+
+void EhFrameUnwinder::did_unmap(const KernelMapping& recorded_map) {
+  if (recorded_map.is_real_device()) {
+    cache->objects.erase(UnwindObjectKey(recorded_map));
+  }
+}
+
+template <typename Arch>
+static void load_object(Task* t, remote_ptr<void> base, UnwindObject& obj) {
+  obj.loaded = true;
+
+  typename Arch::ElfEhdr ehdr;
+  if (t->read_bytes_fallible(base, sizeof(ehdr), &ehdr) != sizeof(ehdr) ||
+      memcmp(&ehdr, ELFMAG, SELFMAG) != 0 ||
+      ehdr.e_ident[EI_CLASS] != Arch::elfclass ||
+      ehdr.e_ident[EI_DATA] != Arch::elfendian ||
+      ehdr.e_machine != Arch::elfmachine ||
+      ehdr.e_phentsize != sizeof(typename Arch::ElfPhdr)) {
+    LOG(debug) << "No valid ELF header at " << base;
+    return;
+  }
+
+  vector<typename Arch::ElfPhdr> phdrs;
+  phdrs.resize(ehdr.e_phnum);
+  ssize_t phdrs_size = phdrs.size() * sizeof(phdrs[0]);
+  if (t->read_bytes_fallible(base + ehdr.e_phoff, phdrs_size, phdrs.data()) !=
+      phdrs_size) {
+    LOG(debug) << "Can't read program headers at " << base;
+    return;
+  }
+
+  const typename Arch::ElfPhdr* first_load = nullptr;
+  const typename Arch::ElfPhdr* eh_frame_hdr = nullptr;
+  for (auto& p : phdrs) {
+    if (p.p_type == PT_LOAD && (!first_load || p.p_vaddr < first_load->p_vaddr)) {
+      first_load = &p;
+    }
+    if (p.p_type == PT_GNU_EH_FRAME) {
+      eh_frame_hdr = &p;
+    }
+  }
+  if (!first_load || !eh_frame_hdr) {
+    LOG(debug) << "No PT_GNU_EH_FRAME for object at " << base;
+    return;
+  }
+  obj.link_base = floor_page_size(first_load->p_vaddr) -
+                  floor_page_size(first_load->p_offset);
+
+  uintptr_t hdr_vaddr = eh_frame_hdr->p_vaddr;
+  vector<uint8_t> hdr;
+  hdr.resize(eh_frame_hdr->p_memsz);
+  remote_ptr<void> hdr_addr = base + (hdr_vaddr - obj.link_base);
+  if (t->read_bytes_fallible(hdr_addr, hdr.size(), hdr.data()) !=
+      ssize_t(hdr.size())) {
+    LOG(debug) << "Can't read .eh_frame_hdr at " << hdr_addr;
+    return;
+  }
+
+  DwarfReader r(hdr, hdr_vaddr, sizeof(typename Arch::unsigned_word));
+  uint8_t version = r.read<uint8_t>();
+  uint8_t eh_frame_ptr_enc = r.read<uint8_t>();
+  uint8_t fde_count_enc = r.read<uint8_t>();
+  uint8_t table_enc = r.read<uint8_t>();
+  r.read_encoded(eh_frame_ptr_enc);
+  uintptr_t fde_count = r.read_encoded(fde_count_enc);
+  // Every linker we know of emits a table of 4-byte offsets relative to
+  // the start of .eh_frame_hdr.
+  if (!r.ok() || version != 1 ||
+      table_enc != (DW_EH_PE_datarel | DW_EH_PE_sdata4)) {
+    LOG(debug) << "Unsupported .eh_frame_hdr at " << hdr_addr;
+    return;
+  }
+  obj.fdes.reserve(fde_count);
+  for (uintptr_t i = 0; i < fde_count; ++i) {
+    uintptr_t pc = hdr_vaddr + r.read<int32_t>();
+    uintptr_t fde = hdr_vaddr + r.read<int32_t>();
+    obj.fdes.push_back(make_pair(pc, fde));
+  }
+  if (!r.ok()) {
+    LOG(debug) << "Truncated .eh_frame_hdr at " << hdr_addr;
+    obj.fdes.clear();
+    return;
+  }
+  obj.valid = true;
+}
+
+/**
+ * Read the CIE or FDE record at link-time address |vaddr| (including its
+ * length field) into |record|.
+ */
+static bool read_record(Task* t, uintptr_t bias, uintptr_t vaddr,
+                        vector<uint8_t>& record) {
+  static const uint32_t MAX_RECORD_SIZE = 1024 * 1024;
+  uint32_t length;
+  remote_ptr<void> addr = bias + vaddr;
+  if (t->read_bytes_fallible(addr, sizeof(length), &length) !=
+      sizeof(length)) {
+    return false;
+  }
+  // 0 is a terminator and 0xffffffff introduces the 64-bit DWARF format,
+  // which nobody uses for .eh_frame.
+  if (length == 0 || length > MAX_RECORD_SIZE) {
+    return false;
+  }
+  record.resize(sizeof(length) + length);
+  return t->read_bytes_fallible(addr, record.size(), record.data()) ==
+         ssize_t(record.size());
+}
+
+template <typename Arch>
+static bool parse_cie(Task* t, uintptr_t bias, uintptr_t vaddr, Cie& cie) {
+  if (!read_record(t, bias, vaddr, cie.data)) {
+    return false;
+  }
+  cie.vaddr = vaddr;
+  DwarfReader r(cie.data, vaddr, sizeof(typename Arch::unsigned_word));
+  r.read<uint32_t>();
+  if (r.read<uint32_t>() != 0) {
+    // Not a CIE.
+    return false;
+  }
+  uint8_t version = r.read<uint8_t>();
+  string augmentation;
+  while (char c = r.read<char>()) {
+    augmentation += c;
+  }
+  if (version == 4) {
+    // address_size and segment_selector_size
+    r.skip(2);
+  }
+  cie.code_align = r.read_uleb();
+  cie.data_align = r.read_sleb();
+  cie.ra_reg = version == 1 ? r.read<uint8_t>() : r.read_uleb();
+  cie.fde_encoding = DW_EH_PE_absptr;
+  cie.has_augmentation_data = false;
+
+  size_t augmentation_end = r.offset();
+  for (size_t i = 0; i < augmentation.size(); ++i) {
+    switch (augmentation[i]) {
+      case 'z':
+        if (i != 0) {
+          return false;
+        }
+        cie.has_augmentation_data = true;
+        augmentation_end = r.read_uleb();
+        augmentation_end += r.offset();
+        break;
+      case 'R':
+        cie.fde_encoding = r.read<uint8_t>();
+        break;
+      case 'P': {
+        uint8_t encoding = r.read<uint8_t>();
+        r.read_encoded(encoding);
+        break;
+      }
+      case 'L':
+        r.read<uint8_t>();
+        break;
+      case 'S':
+        break;
+      default:
+        // Unknown augmentations are only skippable with 'z'.
+        if (!cie.has_augmentation_data) {
+          return false;
+        }
+        i = augmentation.size();
+        break;
+    }
+  }
+  if (cie.has_augmentation_data) {
+    r.set_range(augmentation_end, cie.data.size());
+  }
+  cie.insns_start = r.offset();
+  cie.insns_end = cie.data.size();
+  return r.ok();
+}
+
+static void set_reg_rule(CfiState& state, uint64_t reg, const RegRule& rule,
+                         uint64_t ra_reg, int bp_reg) {
+  if (reg == ra_reg) {
+    state.ra = rule;
+  } else if (reg == uint64_t(bp_reg)) {
+    state.bp = rule;
+  }
+}
+
+/**
+ * Execute call frame instructions from |r| into |state|, starting at code
+ * address |*loc|, until the instructions are exhausted or they advance past
+ * |pc|. Returns false if the instructions are malformed.
+ */
+template <typename Arch>
+static bool execute_cfi(DwarfReader& r, const Cie& cie, uintptr_t pc,
+                        uintptr_t* loc, const CfiState& initial,
+                        CfiState& state) {
+  static const int BP = DwarfRegs<Arch>::BP;
+  vector<CfiState> saved_states;
+  while (!r.at_end() && r.ok()) {
+    uint8_t op = r.read<uint8_t>();
+    uint64_t reg;
+    uint64_t delta = 0;
+    switch (op & 0xc0) {
+      case DW_CFA_advance_loc:
+        delta = op & 0x3f;
+        break;
+      case DW_CFA_offset:
+        set_reg_rule(state, op & 0x3f,
+                     RegRule(RegRule::SAVED_AT_CFA_OFFSET,
+                             r.read_uleb() * cie.data_align),
+                     cie.ra_reg, BP);
+        continue;
+      case DW_CFA_restore:
+        reg = op & 0x3f;
+        set_reg_rule(state, reg, reg == cie.ra_reg ? initial.ra : initial.bp,
+                     cie.ra_reg, BP);
+        continue;
+      default:
+        switch (op) {
+          case DW_CFA_nop:
+          case DW_CFA_GNU_args_size:
+            if (op == DW_CFA_GNU_args_size) {
+              r.read_uleb();
+            }
+            continue;
+          case DW_CFA_set_loc:
+            *loc = r.read_encoded(cie.fde_encoding);
+            if (*loc > pc) {
+              return r.ok();
+            }
+            continue;
+          case DW_CFA_advance_loc1:
+            delta = r.read<uint8_t>();
+            break;
+          case DW_CFA_advance_loc2:
+            delta = r.read<uint16_t>();
+            break;
+          case DW_CFA_advance_loc4:
+            delta = r.read<uint32_t>();
+            break;
+          case DW_CFA_offset_extended:
+            reg = r.read_uleb();
+            set_reg_rule(state, reg,
+                         RegRule(RegRule::SAVED_AT_CFA_OFFSET,
+                                 r.read_uleb() * cie.data_align),
+                         cie.ra_reg, BP);
+            continue;
+          case DW_CFA_offset_extended_sf:
+            reg = r.read_uleb();
+            set_reg_rule(state, reg,
+                         RegRule(RegRule::SAVED_AT_CFA_OFFSET,
+                                 r.read_sleb() * cie.data_align),
+                         cie.ra_reg, BP);
+            continue;
+          case DW_CFA_GNU_negative_offset_extended:
+            reg = r.read_uleb();
+            set_reg_rule(state, reg,
+                         RegRule(RegRule::SAVED_AT_CFA_OFFSET,
+                                 -int64_t(r.read_uleb()) * cie.data_align),
+                         cie.ra_reg, BP);
+            continue;
+          case DW_CFA_restore_extended:
+            reg = r.read_uleb();
+            set_reg_rule(state, reg,
+                         reg == cie.ra_reg ? initial.ra : initial.bp,
+                         cie.ra_reg, BP);
+            continue;
+          case DW_CFA_same_value:
+            set_reg_rule(state, r.read_uleb(), RegRule(RegRule::SAME),
+                         cie.ra_reg, BP);
+            continue;
+          case DW_CFA_undefined:
+            set_reg_rule(state, r.read_uleb(), RegRule(RegRule::UNSUPPORTED),
+                         cie.ra_reg, BP);
+            continue;
+          case DW_CFA_register:
+            reg = r.read_uleb();
+            r.read_uleb();
+            set_reg_rule(state, reg, RegRule(RegRule::UNSUPPORTED), cie.ra_reg,
+                         BP);
+            continue;
+          case DW_CFA_val_offset:
+          case DW_CFA_val_offset_sf:
+            reg = r.read_uleb();
+            if (op == DW_CFA_val_offset) {
+              r.read_uleb();
+            } else {
+              r.read_sleb();
+            }
+            set_reg_rule(state, reg, RegRule(RegRule::UNSUPPORTED), cie.ra_reg,
+                         BP);
+            continue;
+          case DW_CFA_expression:
+          case DW_CFA_val_expression:
+            reg = r.read_uleb();
+            r.skip(r.read_uleb());
+            set_reg_rule(state, reg, RegRule(RegRule::UNSUPPORTED), cie.ra_reg,
+                         BP);
+            continue;
+          case DW_CFA_remember_state:
+            saved_states.push_back(state);
+            continue;
+          case DW_CFA_restore_state:
+            if (saved_states.empty()) {
+              return false;
+            }
+            state = saved_states.back();
+            saved_states.pop_back();
+            continue;
+          case DW_CFA_def_cfa:
+            state.cfa_reg = r.read_uleb();
+            state.cfa_offset = r.read_uleb();
+            state.cfa_supported = true;
+            continue;
+          case DW_CFA_def_cfa_sf:
+            state.cfa_reg = r.read_uleb();
+            state.cfa_offset = r.read_sleb() * cie.data_align;
+            state.cfa_supported = true;
+            continue;
+          case DW_CFA_def_cfa_register:
+            state.cfa_reg = r.read_uleb();
+            continue;
+          case DW_CFA_def_cfa_offset:
+            state.cfa_offset = r.read_uleb();
+            continue;
+          case DW_CFA_def_cfa_offset_sf:
+            state.cfa_offset = r.read_sleb() * cie.data_align;
+            continue;
+          case DW_CFA_def_cfa_expression:
+            r.skip(r.read_uleb());
+            state.cfa_supported = false;
+            continue;
+          default:
+            LOG(debug) << "Unknown CFA instruction " << HEX(op);
+            return false;
+        }
+    }
+    *loc += delta * cie.code_align;
+    if (*loc > pc) {
+      break;
+    }
+  }
+  return r.ok();
+}
+
+template <typename Arch>
+static FrameRule compute_frame_rule(Task* t, uintptr_t bias,
+                                    const UnwindObject& obj, uintptr_t pc) {
+  static const int SP = DwarfRegs<Arch>::SP;
+  static const int BP = DwarfRegs<Arch>::BP;
+  FrameRule result;
+
+  auto it = upper_bound(obj.fdes.begin(), obj.fdes.end(),
+                        make_pair(pc, UINTPTR_MAX));
+  if (it == obj.fdes.begin()) {
+    return result;
+  }
+  --it;
+  uintptr_t fde_vaddr = it->second;
+
+  vector<uint8_t> fde;
+  if (!read_record(t, bias, fde_vaddr, fde)) {
+    return result;
+  }
+  DwarfReader r(fde, fde_vaddr, sizeof(typename Arch::unsigned_word));
+  r.read<uint32_t>();
+  uintptr_t cie_pointer_vaddr = r.vaddr();
+  uint32_t cie_pointer = r.read<uint32_t>();
+  Cie cie;
+  if (!r.ok() || cie_pointer == 0 ||
+      !parse_cie<Arch>(t, bias, cie_pointer_vaddr - cie_pointer, cie)) {
+    return result;
+  }
+  uintptr_t pc_begin = r.read_encoded(cie.fde_encoding);
+  uintptr_t pc_range = r.read_encoded(cie.fde_encoding & 0x0f);
+  if (!r.ok() || pc < pc_begin || pc >= pc_begin + pc_range) {
+    return result;
+  }
+  if (cie.has_augmentation_data) {
+    r.skip(r.read_uleb());
+  }
+
+  CfiState state;
+  uintptr_t loc = pc_begin;
+  DwarfReader cie_insns(cie.data, cie.vaddr,
+                        sizeof(typename Arch::unsigned_word));
+  cie_insns.set_range(cie.insns_start, cie.insns_end);
+  if (!execute_cfi<Arch>(cie_insns, cie, UINTPTR_MAX, &loc, state, state)) {
+    return result;
+  }
+  CfiState initial = state;
+  loc = pc_begin;
+  if (!execute_cfi<Arch>(r, cie, pc, &loc, initial, state)) {
+    return result;
+  }
+
+  if (!state.cfa_supported || (state.cfa_reg != SP && state.cfa_reg != BP) ||
+      state.ra.kind != RegRule::SAVED_AT_CFA_OFFSET ||
+      state.bp.kind == RegRule::UNSUPPORTED) {
+    return result;
+  }
+  result.valid = true;
+  result.cfa_is_bp = state.cfa_reg == BP;
+  result.cfa_offset = state.cfa_offset;
+  result.ra_offset = state.ra.offset;
+  result.bp_saved = state.bp.kind == RegRule::SAVED_AT_CFA_OFFSET;
+  result.bp_offset = state.bp.offset;
+  return result;
+}
+
+/**
+ * Find the load bias of the object mapped at |m| (the difference between
+ * run-time and link-time addresses), loading its unwind data if necessary.
+ * Returns null if the object has no usable unwind data.
+ */
+template <typename Arch>
+static UnwindObject* object_for_mapping(
+    Task* t, map<UnwindObjectKey, UnwindObject>& objects,
+    const AddressSpace::Mapping& m, uintptr_t* bias) {
+  // Use the recorded mapping to identify the object, since during replay
+  // the file we actually mapped may be a copy in the trace directory.
+  const KernelMapping& recorded = m.recorded_map;
+  UnwindObject& obj = objects[UnwindObjectKey(recorded)];
+  auto key = make_pair(m.map.start().as_int(), recorded.file_offset_bytes());
+  auto it = obj.biases.find(key);
+  if (it != obj.biases.end()) {
+    *bias = it->second;
+    return obj.valid ? &obj : nullptr;
+  }
+
+  // Find where the start of the file is mapped: the closest mapping of the
+  // same file at offset 0 below |m|.
+  remote_ptr<void> base;
+  for (auto other : t->vm()->maps()) {
+    if (other.map.start() > m.map.start()) {
+      break;
+    }
+    const KernelMapping& r = other.recorded_map;
+    if (r.file_offset_bytes() == 0 && r.device() == recorded.device() &&
+        r.inode() == recorded.inode() && r.fsname() == recorded.fsname()) {
+      base = other.map.start();
+    }
+  }
+  if (base.is_null()) {
+    return nullptr;
+  }
+  if (!obj.loaded) {
+    load_object<Arch>(t, base, obj);
+  }
+  *bias = base.as_int() - obj.link_base;
+  obj.biases[key] = *bias;
+  return obj.valid ? &obj : nullptr;
+}
+
+template <typename Arch>
+static bool find_frame_rule(Task* t,
+                            map<UnwindObjectKey, UnwindObject>& objects,
+                            uintptr_t pc, FrameRule* rule) {
+  if (!t->vm()->has_mapping(pc)) {
+    return false;
+  }
+  const AddressSpace::Mapping& m = t->vm()->mapping_of(pc);
+  if (!m.recorded_map.is_real_device() || !(m.map.prot() & PROT_EXEC)) {
+    return false;
+  }
+  uintptr_t bias;
+  UnwindObject* obj = object_for_mapping<Arch>(t, objects, m, &bias);
+  if (!obj) {
+    return false;
+  }
+  uintptr_t link_pc = pc - bias;
+  auto it = obj->rules.find(link_pc);
+  if (it == obj->rules.end()) {
+    it = obj->rules.insert(make_pair(link_pc, compute_frame_rule<Arch>(
+                                                  t, bias, *obj, link_pc)))
+             .first;
+  }
+  *rule = it->second;
+  return rule->valid;
+}
+
+template <typename Arch>
+static size_t unwind_arch(Task* t,
+                          map<UnwindObjectKey, UnwindObject>& objects,
+                          remote_ptr<void>* addresses, size_t count) {
+  const Registers& regs = t->regs();
+  uintptr_t pc = regs.ip().register_value();
+  uintptr_t sp = regs.sp().as_int();
+  uintptr_t bp = regs.bp();
+  size_t n = 0;
+  while (n < count) {
+    FrameRule rule;
+    // Return addresses point after the call instruction, which may be
+    // the first instruction of the next function (or outside any
+    // function), so look up the rule for the call instruction itself.
+    if (!find_frame_rule<Arch>(t, objects, n == 0 ? pc : pc - 1, &rule)) {
+      break;
+    }
+    uintptr_t cfa = (rule.cfa_is_bp ? bp : sp) + rule.cfa_offset;
+    if (cfa <= sp) {
+      // Corrupt stack or unwind info; don't loop.
+      break;
+    }
+    typename Arch::unsigned_word ra;
+    if (t->read_bytes_fallible(cfa + rule.ra_offset, sizeof(ra), &ra) !=
+        sizeof(ra)) {
+      break;
+    }
+    if (rule.bp_saved) {
+      typename Arch::unsigned_word saved_bp;
+      if (t->read_bytes_fallible(cfa + rule.bp_offset, sizeof(saved_bp),
+                                 &saved_bp) != sizeof(saved_bp)) {
+        break;
+      }
+      bp = saved_bp;
+    }
+    if (!ra) {
+      break;
+    }
+    addresses[n++] = ra;
+    pc = ra;
+    sp = cfa;
+  }
+  return n;
+}
+
+size_t EhFrameUnwinder::unwind(Task* t, remote_ptr<void>* addresses,
+                               size_t count) {
+  RR_ARCH_FUNCTION(unwind_arch, t->arch(), t, cache->objects, addresses,
+                   count);
+}
+
+} // namespace rr
@@ -0,0 +1,56 @@
+/* -*- Mode: C++; tab-width: 8; c-basic-offset: 2; indent-tabs-mode: nil; -*- */
+
+#ifndef RR_EH_FRAME_UNWINDER_H_
+#define RR_EH_FRAME_UNWINDER_H_
+
+#include <stddef.h>
+
+#include <memory>
+
+#include "remote_ptr.h"
+
+namespace rr {
+
+class KernelMapping;
+class Task;
+
+/**
+ * Computes the return addresses on a stopped task's stack using the DWARF
+ * call frame information in the .eh_frame sections of its mapped ELF
+ * objects. Unlike following the frame-pointer chain, this works for code
+ * compiled with -fomit-frame-pointer.
+ *
+ * Unwind tables are located through PT_GNU_EH_FRAME and read from tracee
+ * memory. They're cached per ELF object, as are the CFA rules computed for
+ * each code address, so unwinding repeatedly through the same code is cheap.
+ * Each AddressSpace has its own EhFrameUnwinder, and an object's cached data
+ * is dropped when any of its mappings is unmapped, so nothing computed from
+ * one mapping of a file is applied to another.
+ */
+class EhFrameUnwinder {
+public:
+  EhFrameUnwinder();
+  EhFrameUnwinder(const EhFrameUnwinder& other);
+  ~EhFrameUnwinder();
+
+  /**
+   * Store up to |count| return addresses from |t|'s stack in |addresses|,
+   * innermost frame first. Returns the number of addresses stored, which
+   * is zero if the frame at |t|'s current ip can't be unwound (e.g. JITted
+   * code, or code without unwind info).
+   */
+  size_t unwind(Task* t, remote_ptr<void>* addresses, size_t count);
+
+  /**
+   * Called when (part of) |recorded_map| is unmapped.
+   */
+  void did_unmap(const KernelMapping& recorded_map);
+
+private:
+  struct Cache;
+  std::unique_ptr<Cache> cache;
+};
+
+} // namespace rr
+
+#endif /* RR_EH_FRAME_UNWINDER_H_ */
@@ -2,7 +2,10 @@
 
 #include "EmuFs.h"
 
+#include <fcntl.h>
 #include <syscall.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
 
 #include <fstream>
 #include <sstream>
@@ -11,6 +14,7 @@
 #include "AddressSpace.h"
 #include "kernel_abi.h"
 #include "kernel_metadata.h"
+#include "kernel_supplement.h"
 #include "log.h"
 #include "ReplaySession.h"
 
@@ -30,10 +34,77 @@ EmuFile::~EmuFile() {
   owner.destroyed_file(*this);
 }
 
+/**
+ * Copy [offset, offset + len) of |src| to the same offset in |dest| within
+ * the kernel. Returns false if the kernel can't do that for these files.
+ */
+static bool copy_range_in_kernel(int src, int dest, uint64_t offset,
+                                 uint64_t len) {
+#ifdef SYS_copy_file_range
+  while (len > 0) {
+    loff_t in_offset = offset;
+    loff_t out_offset = offset;
+    ssize_t ret = syscall(SYS_copy_file_range, src, &in_offset, dest,
+                          &out_offset, len, 0);
+    if (ret < 0 && errno == EINTR) {
+      continue;
+    }
+    if (ret <= 0) {
+      return false;
+    }
+    offset += ret;
+    len -= ret;
+  }
+  return true;
+#else
+  return false;
+#endif
+}
+
+/**
+ * Copy the data in the first |size| bytes of |src| to |dest|, which must
+ * already be |size| bytes long and contain only zeroes. Emulated files are
+ * often mostly holes (e.g. shm segments that were ftruncate()d but only
+ * partly touched), so we skip the holes and only copy the data extents.
+ * Returns false if we couldn't; |dest| may then be partly written.
+ */
+static bool copy_data_extents(int src, int dest, uint64_t size) {
+  uint64_t offset = 0;
+  while (offset < size) {
+    off64_t data = lseek64(src, offset, SEEK_DATA);
+    if (data < 0) {
+      if (errno == ENXIO) {
+        // Only a hole remains.
+        return true;
+      }
+      // Holes aren't supported here; treat everything as data.
+      return copy_range_in_kernel(src, dest, offset, size - offset);
+    }
+    if ((uint64_t)data >= size) {
+      return true;
+    }
+    off64_t hole = lseek64(src, data, SEEK_HOLE);
+    if (hole < 0 || (uint64_t)hole > size) {
+      hole = size;
+    }
+    if (!copy_range_in_kernel(src, dest, data, hole - data)) {
+      return false;
+    }
+    offset = hole;
+  }
+  return true;
+}
+
 EmuFile::shr_ptr EmuFile::clone(EmuFs& owner) {
   auto f = EmuFile::create(owner, orig_path.c_str(), device(), inode(), size_);
-  // NB: this isn't the most efficient possible file copy, but
-  // it's simple and not too slow.
+  // If SHMEM_FS supports reflinks the clone shares all its blocks until
+  // they're written. tmpfs doesn't, but copy_file_range() at least keeps
+  // the data out of userspace, and we don't copy holes at all.
+  if (ioctl(f->fd(), BTRFS_IOC_CLONE, fd().get()) == 0 ||
+      copy_data_extents(fd(), f->fd(), size_)) {
+    return f;
+  }
+  // Old kernels: fall back to copying through userspace.
   ifstream src(proc_path(), ifstream::binary);
   ofstream dst(f->proc_path(), ofstream::binary);
   dst << src.rdbuf();
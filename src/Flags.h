@@ -58,6 +58,14 @@ struct Flags {
   // under valgrind.
   std::string forced_uarch;
 
+  // Measure ticks-interrupt skid on this CPU instead of using the
+  // conservative per-microarchitecture maximum.
+  bool calibrate_skid;
+
+  // When nonempty, record and autopilot replay write session statistics
+  // (ticks, syscalls, ptrace stops etc) to this file as JSON on exit.
+  std::string statistics_file;
+
   Flags()
       : checksum(CHECKSUM_NONE),
         dump_on(DUMP_ON_NONE),
@@ -65,7 +73,8 @@ struct Flags {
         force_things(false),
         mark_stdio(false),
         check_cached_mmaps(false),
-        suppress_environment_warnings(false) {}
+        suppress_environment_warnings(false),
+        calibrate_skid(false) {}
 
   static const Flags& get() { return singleton; }
 
@@ -38,6 +38,10 @@ namespace rr {
 
 static const char INTERRUPT_CHAR = '\x03';
 
+// The rr-thread-regs annex comes straight from gdb; refuse requests for more
+// stack per thread than this rather than trying to allocate it.
+static const size_t MAX_THREAD_REGS_STACK_BYTES = 64 * 1024;
+
 #ifdef DEBUGTAG
 #define UNHANDLED_REQ() FATAL()
 #else
@@ -60,7 +64,10 @@ static bool request_needs_immediate_response(const GdbRequest* req) {
 }
 
 GdbConnection::GdbConnection(pid_t tgid, const Features& features)
-    : tgid(tgid), no_ack(false), features_(features) {
+    : tgid(tgid),
+      no_ack(false),
+      thread_regs_xfer_len(0),
+      features_(features) {
 #ifndef REVERSE_EXECUTION
   features_.reverse_execution = false;
 #endif
@@ -372,6 +379,20 @@ void GdbConnection::write_hex_bytes_packet(const uint8_t* bytes, size_t len) {
   write_packet(buf);
 }
 
+void GdbConnection::write_xfer_response(const string& data, size_t offset,
+                                        size_t len) {
+  if (offset >= data.size()) {
+    write_packet("l");
+    return;
+  }
+  if (offset + len < data.size()) {
+    write_binary_packet("m", (const uint8_t*)data.data() + offset, len);
+    return;
+  }
+  write_binary_packet("l", (const uint8_t*)data.data() + offset,
+                      data.size() - offset);
+}
+
 static void parser_assert(bool cond) {
   if (!cond) {
     fputs("Failed to parse gdb request\n", stderr);
@@ -520,9 +541,14 @@ bool GdbConnection::xfer(const char* name, char* args) {
 
   if (!strcmp(name, "auxv")) {
     parser_assert(!strncmp(args, "read::", sizeof("read::") - 1));
+    args += strlen("read::");
 
     req = GdbRequest(DREQ_GET_AUXV);
     req.target = query_thread;
+    req.mem().addr = strtoul(args, &args, 16);
+    parser_assert(',' == *args++);
+    req.mem().len = strtoul(args, &args, 16);
+    parser_assert('\0' == *args);
     return true;
   }
   if (name == strstr(name, "siginfo")) {
@@ -550,6 +576,48 @@ bool GdbConnection::xfer(const char* name, char* args) {
     return false;
   }
 
+  if (!strcmp(name, "rr-thread-regs")) {
+    parser_assert(!strncmp(args, "read:", sizeof("read:") - 1));
+    args += strlen("read:");
+    const char* annex = args;
+    args = strchr(args, ':');
+    parser_assert(args);
+    *args++ = '\0';
+    size_t offset = strtoul(args, &args, 16);
+    parser_assert(',' == *args++);
+    size_t len = strtoul(args, &args, 16);
+    parser_assert('\0' == *args);
+
+    if (offset > 0) {
+      // A follow-up read of the object we generated for the first chunk.
+      if (annex != thread_regs_xfer_annex) {
+        write_packet("E01");
+        return false;
+      }
+      write_xfer_response(thread_regs_xfer, offset, len);
+      return false;
+    }
+
+    // The annex is the (hex) number of stack bytes wanted for each thread.
+    char* endp;
+    size_t stack_bytes = strtoul(annex, &endp, 16);
+    parser_assert('\0' == *endp);
+    if (!*annex) {
+      stack_bytes = 256;
+    }
+    if (stack_bytes > MAX_THREAD_REGS_STACK_BYTES) {
+      write_packet("E01");
+      return false;
+    }
+    thread_regs_xfer_annex = annex;
+    thread_regs_xfer_len = len;
+    req = GdbRequest(DREQ_GET_THREAD_REGS);
+    req.target = GdbThreadId::ALL;
+    req.mem().addr = 0;
+    req.mem().len = stack_bytes;
+    return true;
+  }
+
   UNHANDLED_REQ() << "Unhandled gdb xfer request: " << name << "(" << args
                   << ")";
   return false;
@@ -671,7 +739,9 @@ bool GdbConnection::query(char* payload) {
                  ";qXfer:auxv:read+"
                  ";qXfer:siginfo:read+"
                  ";qXfer:siginfo:write+"
+                 ";qXfer:rr-thread-regs:read+"
                  ";multiprocess+"
+                 ";binary-upload+"
                  ";ConditionalBreakpoints+";
     if (features().reverse_execution) {
       supported << ";ReverseContinue+"
@@ -1027,6 +1097,19 @@ bool GdbConnection::process_packet() {
       LOG(debug) << "gdb requests memory (addr=" << HEX(req.mem().addr)
                  << ", len=" << req.mem().len << ")";
 
+      ret = true;
+      break;
+    case 'x':
+      req = GdbRequest(DREQ_GET_MEM_BINARY);
+      req.target = query_thread;
+      req.mem().addr = strtoul(payload, &payload, 16);
+      parser_assert(',' == *payload++);
+      req.mem().len = strtoul(payload, &payload, 16);
+      parser_assert('\0' == *payload);
+
+      LOG(debug) << "gdb requests binary memory (addr=" << HEX(req.mem().addr)
+                 << ", len=" << req.mem().len << ")";
+
       ret = true;
       break;
     case 'M':
@@ -1409,7 +1492,8 @@ void GdbConnection::reply_get_auxv(const vector<uint8_t>& auxv) {
   assert(DREQ_GET_AUXV == req.type);
 
   if (!auxv.empty()) {
-    write_binary_packet("l", auxv.data(), auxv.size());
+    write_xfer_response(string(auxv.begin(), auxv.end()), req.mem().addr,
+                        req.mem().len);
   } else {
     write_packet("E01");
   }
@@ -1449,11 +1533,13 @@ void GdbConnection::reply_select_thread(bool ok) {
 }
 
 void GdbConnection::reply_get_mem(const vector<uint8_t>& mem) {
-  assert(DREQ_GET_MEM == req.type);
+  assert(DREQ_GET_MEM == req.type || DREQ_GET_MEM_BINARY == req.type);
   assert(mem.size() <= req.mem().len);
 
   if (req.mem().len > 0 && mem.size() == 0) {
     write_packet("E01");
+  } else if (DREQ_GET_MEM_BINARY == req.type) {
+    write_binary_packet("b", mem.data(), mem.size());
   } else {
     write_hex_bytes_packet(mem.data(), mem.size());
   }
@@ -1518,6 +1604,46 @@ void GdbConnection::reply_get_regs(const GdbRegisterFile& file) {
   consume_request();
 }
 
+void GdbConnection::reply_get_thread_regs(
+    const vector<GdbThreadRegs>& threads) {
+  assert(DREQ_GET_THREAD_REGS == req.type);
+
+  // Use single-quoted attributes so the document survives being echoed
+  // back by gdb's "maint packet" unescaped.
+  stringstream ss;
+  ss << "<rr-thread-regs>";
+  for (auto& t : threads) {
+    if (tgid != t.id.pid) {
+      continue;
+    }
+    char id[64];
+    snprintf(id, sizeof(id), "p%02x.%02x", t.id.pid, t.id.tid);
+    ss << "<thread id='" << id << "' regs='";
+
+    size_t max_chars =
+        t.regs.total_registers() * 2 * GdbRegisterValue::MAX_SIZE;
+    vector<char> buf(max_chars + 1);
+    size_t offset = 0;
+    for (auto& reg : t.regs.regs) {
+      offset += print_reg_value(reg, &buf[offset]);
+    }
+    buf[offset] = '\0';
+    ss << buf.data() << "' sp='" << hex << t.sp << dec << "' stack='";
+    for (uint8_t b : t.stack) {
+      char byte[3];
+      snprintf(byte, sizeof(byte), "%02x", b);
+      ss << byte;
+    }
+    ss << "'/>";
+  }
+  ss << "</rr-thread-regs>";
+
+  thread_regs_xfer = ss.str();
+  write_xfer_response(thread_regs_xfer, 0, thread_regs_xfer_len);
+
+  consume_request();
+}
+
 void GdbConnection::reply_set_reg(bool ok) {
   assert(DREQ_SET_REG == req.type);
 
@@ -212,6 +212,50 @@ void GdbServer::dispatch_regs_request(const Registers& regs,
   dbg->reply_get_regs(file);
 }
 
+void GdbServer::read_mem(Task* t, remote_ptr<void> addr, size_t len,
+                         vector<uint8_t>& mem) {
+  mem.clear();
+  if (!(t->vm()->uid() == mem_cache_vm)) {
+    invalidate_mem_cache();
+    mem_cache_vm = t->vm()->uid();
+  }
+
+  remote_ptr<void> end = addr + len;
+  if (len <= page_size()) {
+    while (addr < end) {
+      remote_ptr<void> page = floor_page_size(addr);
+      auto it = mem_cache.find(page);
+      if (it == mem_cache.end()) {
+        vector<uint8_t> buf;
+        buf.resize(page_size());
+        ssize_t nread = t->read_bytes_fallible(page, buf.size(), buf.data());
+        if (nread != ssize_t(buf.size())) {
+          // Partially readable page. Read what we can directly below.
+          break;
+        }
+        t->vm()->replace_breakpoints_with_original_values(
+            buf.data(), buf.size(), page.cast<uint8_t>());
+        it = mem_cache.insert(make_pair(page, move(buf))).first;
+      }
+      size_t offset = addr - page;
+      size_t n = min<size_t>(end - addr, page_size() - offset);
+      mem.insert(mem.end(), it->second.begin() + offset,
+                 it->second.begin() + offset + n);
+      addr += n;
+    }
+    if (addr >= end) {
+      return;
+    }
+  }
+
+  size_t offset = mem.size();
+  mem.resize(offset + (end - addr));
+  ssize_t nread = t->read_bytes_fallible(addr, end - addr, mem.data() + offset);
+  mem.resize(offset + max(ssize_t(0), nread));
+  t->vm()->replace_breakpoints_with_original_values(
+      mem.data() + offset, mem.size() - offset, addr.cast<uint8_t>());
+}
+
 class GdbBreakpointCondition : public BreakpointCondition {
 public:
   GdbBreakpointCondition(const vector<vector<uint8_t> >& bytecodes) {
@@ -301,6 +345,36 @@ void GdbServer::dispatch_debugger_request(Session& session,
       dbg->reply_get_thread_list(tids);
       return;
     }
+    case DREQ_GET_THREAD_REGS: {
+      vector<GdbThreadRegs> threads;
+      if (state != REPORT_THREADS_DEAD) {
+        for (auto& kv : session.tasks()) {
+          Task* t = kv.second;
+          if (t->task_group()->tguid() != debuggee_tguid) {
+            continue;
+          }
+          // Only report the cached general-purpose registers; fetching
+          // the extra registers would cost a ptrace call per thread and
+          // isn't needed for unwinding. Those registers are reported as
+          // undefined.
+          const Registers& regs = t->regs();
+          ExtraRegisters extra_regs(t->arch());
+          vector<uint8_t> no_data;
+          extra_regs.set_to_raw_data(t->arch(), ExtraRegisters::XSAVE,
+                                     no_data);
+          size_t n_regs = regs.total_registers();
+          threads.push_back(GdbThreadRegs(get_threadid(t), n_regs));
+          GdbThreadRegs& thread = threads.back();
+          for (size_t i = 0; i < n_regs; ++i) {
+            thread.regs.regs[i] = get_reg(regs, extra_regs, GdbRegister(i));
+          }
+          thread.sp = regs.sp().as_int();
+          read_mem(t, regs.sp(), req.mem().len, thread.stack);
+        }
+      }
+      dbg->reply_get_thread_regs(threads);
+      return;
+    }
     case DREQ_INTERRUPT: {
       Task* t = session.find_task(last_continue_tuid);
       ASSERT(t, session.is_diversion())
@@ -362,14 +436,10 @@ void GdbServer::dispatch_debugger_request(Session& session,
       dbg->reply_get_auxv(target->vm()->saved_auxv());
       return;
     }
-    case DREQ_GET_MEM: {
+    case DREQ_GET_MEM:
+    case DREQ_GET_MEM_BINARY: {
       vector<uint8_t> mem;
-      mem.resize(req.mem().len);
-      ssize_t nread = target->read_bytes_fallible(req.mem().addr, req.mem().len,
-                                                  mem.data());
-      mem.resize(max(ssize_t(0), nread));
-      target->vm()->replace_breakpoints_with_original_values(
-          mem.data(), mem.size(), req.mem().addr);
+      read_mem(target, req.mem().addr, req.mem().len, mem);
       dbg->reply_get_mem(mem);
       return;
     }
@@ -392,6 +462,7 @@ void GdbServer::dispatch_debugger_request(Session& session,
       }
       LOG(debug) << "Writing " << req.mem().len << " bytes to "
                  << HEX(req.mem().addr);
+      invalidate_mem_cache();
       // TODO fallible
       target->write_bytes_helper(req.mem().addr, req.mem().len,
                                  req.mem().data.data());
@@ -513,6 +584,8 @@ void GdbServer::dispatch_debugger_request(Session& session,
       dbg->reply_write_siginfo();
       return;
     case DREQ_RR_CMD:
+      // rr commands may create or restore checkpoints.
+      invalidate_mem_cache();
       dbg->reply_rr_cmd(
           GdbCommandHandler::process_command(*this, target, req.text()));
       return;
@@ -528,6 +601,7 @@ bool GdbServer::diverter_process_debugger_requests(
     *req = dbg->get_request();
 
     if (req->is_resume_request()) {
+      invalidate_mem_cache();
       return diversion_refcount > 0;
     }
 
@@ -535,6 +609,7 @@ bool GdbServer::diverter_process_debugger_requests(
       case DREQ_RESTART:
       case DREQ_DETACH:
       case DREQ_RR_CMD:
+        invalidate_mem_cache();
         diversion_refcount = 0;
         return false;
 
@@ -703,6 +778,7 @@ GdbRequest GdbServer::divert(ReplaySession& replay) {
   }
   DiversionSession::shr_ptr diversion_session = replay.clone_diversion();
   uint32_t diversion_refcount = 1;
+  invalidate_mem_cache();
   TaskUid saved_query_tuid = last_query_tuid;
 
   while (diverter_process_debugger_requests(*diversion_session,
@@ -746,6 +822,7 @@ GdbRequest GdbServer::divert(ReplaySession& replay) {
   assert(diversion_refcount == 0);
 
   diversion_session->kill_all_tasks();
+  invalidate_mem_cache();
 
   last_query_tuid = saved_query_tuid;
   return req;
@@ -761,6 +838,11 @@ GdbRequest GdbServer::process_debugger_requests(ReportState state) {
     req.suppress_debugger_stop = false;
     try_lazy_reverse_singlesteps(req);
 
+    if (req.is_resume_request() || req.type == DREQ_INTERRUPT ||
+        req.type == DREQ_RESTART || req.type == DREQ_DETACH) {
+      invalidate_mem_cache();
+    }
+
     if (req.type == DREQ_READ_SIGINFO) {
       // TODO: we send back a dummy siginfo_t to gdb
       // so that it thinks the request succeeded.
@@ -855,6 +937,7 @@ void GdbServer::try_lazy_reverse_singlesteps(GdbRequest& req) {
 
   if (need_seek) {
     timeline.seek_to_mark(now);
+    invalidate_mem_cache();
   }
 }
 
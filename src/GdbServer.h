@@ -114,6 +114,19 @@ private:
 
   void dispatch_regs_request(const Registers& regs,
                              const ExtraRegisters& extra_regs);
+  /**
+   * Read |len| bytes at |addr| in |t|'s address space into |mem| on behalf
+   * of the debugger, with breakpoints replaced by their original values.
+   * Small reads are served from |mem_cache|. |mem| is truncated if the
+   * memory can't be (fully) read.
+   */
+  void read_mem(Task* t, remote_ptr<void> addr, size_t len,
+                std::vector<uint8_t>& mem);
+  /**
+   * Discard all cached debuggee memory. Call this whenever tracee memory
+   * may have changed, e.g. before execution is resumed.
+   */
+  void invalidate_mem_cache() { mem_cache.clear(); }
   enum ReportState { REPORT_NORMAL, REPORT_THREADS_DEAD };
   /**
    * Process the single debugger request |req|, made by |dbg| targeting
@@ -211,6 +224,14 @@ private:
   ReplayTimeline timeline;
   Session* emergency_debug_session;
 
+  // Whole pages of debuggee memory read on behalf of the debugger since
+  // execution last stopped, with breakpoints already removed. gdb issues
+  // thousands of small reads while loading symbols and unwinding; serving
+  // them from cached pages avoids a tracee memory read for each one.
+  // Only valid for |mem_cache_vm|.
+  std::map<remote_ptr<void>, std::vector<uint8_t> > mem_cache;
+  AddressSpaceUid mem_cache_vm;
+
   struct Checkpoint {
     enum Explicit { EXPLICIT, NOT_EXPLICIT };
     Checkpoint(ReplayTimeline& timeline, TaskUid last_continue_tuid, Explicit e,
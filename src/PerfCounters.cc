@@ -6,6 +6,7 @@
 #include <err.h>
 #include <fcntl.h>
 #include <linux/perf_event.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -14,6 +15,7 @@
 #include <unistd.h>
 
 #include <algorithm>
+#include <list>
 #include <string>
 
 #include "Flags.h"
@@ -26,11 +28,24 @@ using namespace std;
 namespace rr {
 
 static bool attributes_initialized;
+// Some kernels don't apply PERF_EVENT_IOC_PERIOD until the next overflow,
+// so on those we have to reopen the counters to change the period.
+static bool has_ioc_period_bug;
 static struct perf_event_attr ticks_attr;
 static struct perf_event_attr page_faults_attr;
 static struct perf_event_attr hw_interrupts_attr;
 static struct perf_event_attr instructions_retired_attr;
 
+// Stopped tasks keep their counters open so the next reset() can reprogram
+// them cheaply, but every open set costs one fd (four with the extra
+// counters). Beyond this many open sets we close the least recently reset
+// stopped ones.
+static const size_t MAX_OPEN_COUNTER_SETS = 128;
+
+// Every PerfCounters with open fds, least recently reset first. Never
+// destroyed, since Tasks may outlive static destructors.
+static list<PerfCounters*>& open_sets = *new list<PerfCounters*>();
+
 /*
  * Find out the cpu model using the cpuid instruction.
  * Full list of CPUIDs at http://sandpile.org/x86/cpuid.htm
@@ -56,23 +71,31 @@ struct PmuConfig {
   unsigned rcb_cntr_event;
   unsigned rinsn_cntr_event;
   unsigned hw_intr_cntr_event;
+  // The largest skid we've observed (plus margin). This is the skid size we
+  // use unless calibration is requested, and calibration never picks a
+  // larger one.
+  Ticks max_skid;
   bool supported;
 };
 
 // XXX please only edit this if you really know what you're doing.
 static const PmuConfig pmu_configs[] = {
-  { IntelSkylake, "Intel Skylake", 0x5101c4, 0x5100c0, 0x5301cb, true },
-  { IntelBroadwell, "Intel Broadwell", 0x5101c4, 0x5100c0, 0x5301cb, true },
-  { IntelHaswell, "Intel Haswell", 0x5101c4, 0x5100c0, 0x5301cb, true },
-  { IntelIvyBridge, "Intel Ivy Bridge", 0x5101c4, 0x5100c0, 0x5301cb, true },
-  { IntelSandyBridge, "Intel Sandy Bridge", 0x5101c4, 0x5100c0, 0x5301cb,
+  { IntelSkylake, "Intel Skylake", 0x5101c4, 0x5100c0, 0x5301cb, 70, true },
+  { IntelBroadwell, "Intel Broadwell", 0x5101c4, 0x5100c0, 0x5301cb, 70,
+    true },
+  { IntelHaswell, "Intel Haswell", 0x5101c4, 0x5100c0, 0x5301cb, 70, true },
+  { IntelIvyBridge, "Intel Ivy Bridge", 0x5101c4, 0x5100c0, 0x5301cb, 70,
+    true },
+  { IntelSandyBridge, "Intel Sandy Bridge", 0x5101c4, 0x5100c0, 0x5301cb, 70,
     true },
-  { IntelNehalem, "Intel Nehalem", 0x5101c4, 0x5100c0, 0x50011d, true },
-  { IntelWestmere, "Intel Westmere", 0x5101c4, 0x5100c0, 0x50011d, true },
-  { IntelPenryn, "Intel Penryn", 0, 0, 0, false },
-  { IntelMerom, "Intel Merom", 0, 0, 0, false },
+  { IntelNehalem, "Intel Nehalem", 0x5101c4, 0x5100c0, 0x50011d, 70, true },
+  { IntelWestmere, "Intel Westmere", 0x5101c4, 0x5100c0, 0x50011d, 70, true },
+  { IntelPenryn, "Intel Penryn", 0, 0, 0, 0, false },
+  { IntelMerom, "Intel Merom", 0, 0, 0, 0, false },
 };
 
+static const PmuConfig* pmu;
+
 static string lowercase(const string& s) {
   string c = s;
   transform(c.begin(), c.end(), c.begin(), ::tolower);
@@ -151,6 +174,164 @@ static void init_perf_event_attr(struct perf_event_attr* attr,
   attr->exclude_guest = 1;
 }
 
+/**
+ * If |out_of_fds| is non-null, running out of fds isn't fatal; instead we
+ * set |*out_of_fds| and return a closed ScopedFd.
+ */
+static ScopedFd start_counter(pid_t tid, int group_fd,
+                              struct perf_event_attr* attr,
+                              bool* out_of_fds = nullptr) {
+  int fd = syscall(__NR_perf_event_open, attr, tid, -1, group_fd,
+                   PERF_FLAG_FD_CLOEXEC);
+  if (0 > fd) {
+    if (errno == EMFILE && out_of_fds) {
+      *out_of_fds = true;
+      return ScopedFd();
+    }
+    if (errno == EACCES) {
+      FATAL() << "Permission denied to use 'perf_event_open'; are perf events "
+                 "enabled? Try 'perf record'.";
+    }
+    if (errno == ENOENT) {
+      FATAL() << "Unable to open performance counter with 'perf_event_open'; "
+                 "are perf events enabled? Try 'perf record'.";
+    }
+    FATAL() << "Failed to initialize counter";
+  }
+  if (ioctl(fd, PERF_EVENT_IOC_ENABLE, 0)) {
+    FATAL() << "Failed to start counter";
+  }
+  return fd;
+}
+
+static void check_for_ioc_period_bug() {
+  // Start a counter with a huge period, then lower the period to 1. If the
+  // new period took effect, the counter overflows almost immediately.
+  struct perf_event_attr attr = rr::ticks_attr;
+  attr.sample_period = 0xffffffff;
+  ScopedFd bug_fd = start_counter(0, -1, &attr);
+
+  uint64_t new_period = 1;
+  if (ioctl(bug_fd, PERF_EVENT_IOC_PERIOD, &new_period)) {
+    FATAL() << "ioctl(PERF_EVENT_IOC_PERIOD) failed";
+  }
+
+  struct pollfd poll_bug_fd = { bug_fd, POLL_IN, 0 };
+  poll(&poll_bug_fd, 1, 0);
+  has_ioc_period_bug = poll_bug_fd.revents == 0;
+  LOG(debug) << "has_ioc_period_bug=" << has_ioc_period_bug;
+}
+
+// How far short of a target we program ticks interrupts.
+static Ticks skid_size;
+
+static volatile sig_atomic_t calibration_fired;
+static volatile int64_t calibration_count;
+static int calibration_fd;
+
+static void calibration_handler(int, siginfo_t*, void*) {
+  int64_t count;
+  if (read(calibration_fd, &count, sizeof(count)) == sizeof(count)) {
+    calibration_count = count;
+  }
+  ioctl(calibration_fd, PERF_EVENT_IOC_DISABLE, 0);
+  calibration_fired = 1;
+}
+
+/**
+ * Program |attr| to interrupt this thread after |period| ticks, spin until
+ * it does, and return how many ticks past |period| the counter was when the
+ * interrupt was delivered. Returns -1 if the counter can't be opened or
+ * never interrupts.
+ */
+static Ticks measure_skid(struct perf_event_attr* attr, Ticks period) {
+  attr->sample_period = period;
+  ScopedFd fd = syscall(__NR_perf_event_open, attr, 0, -1, -1,
+                        PERF_FLAG_FD_CLOEXEC);
+  if (!fd.is_open()) {
+    return -1;
+  }
+  struct f_owner_ex own;
+  own.type = F_OWNER_TID;
+  own.pid = syscall(SYS_gettid);
+  if (fcntl(fd, F_SETOWN_EX, &own) || fcntl(fd, F_SETFL, O_ASYNC) ||
+      fcntl(fd, F_SETSIG, PerfCounters::TIME_SLICE_SIGNAL)) {
+    return -1;
+  }
+  calibration_fd = fd;
+  calibration_fired = 0;
+  calibration_count = -1;
+  if (ioctl(fd, PERF_EVENT_IOC_ENABLE, 0)) {
+    return -1;
+  }
+  // Each iteration retires at least one conditional branch.
+  for (Ticks i = 0; !calibration_fired && i < period * 100; ++i) {
+  }
+  ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+  if (!calibration_fired || calibration_count < period) {
+    return -1;
+  }
+  // This includes branches in the signal handler before it reads the
+  // counter, which just makes the estimate conservative.
+  return calibration_count - period;
+}
+
+/**
+ * Return the largest skid observed over a number of trials with |attr|,
+ * or -1 if calibration failed.
+ */
+static Ticks calibrate_skid(struct perf_event_attr attr) {
+  static const int TRIALS = 50;
+  Ticks max_skid = 0;
+  for (int i = 0; i < TRIALS; ++i) {
+    // Vary the period so we don't always interrupt at the same point in
+    // the loop.
+    Ticks skid = measure_skid(&attr, 10000 + i * 7);
+    if (skid < 0) {
+      return -1;
+    }
+    max_skid = max(max_skid, skid);
+  }
+  return max_skid;
+}
+
+/**
+ * Measure the skid on this CPU, with and without precise (PEBS) sampling,
+ * and pick the ticks counter configuration and skid size to use. This must
+ * run before any ticks counter is opened, since it may change ticks_attr.
+ */
+static void calibrate_skid_size() {
+  struct sigaction sa, old_sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_sigaction = calibration_handler;
+  sa.sa_flags = SA_SIGINFO | SA_RESTART;
+  sigaction(PerfCounters::TIME_SLICE_SIGNAL, &sa, &old_sa);
+
+  Ticks skid = calibrate_skid(ticks_attr);
+  // Precise (PEBS) sampling usually reduces skid. Use it for the ticks
+  // counter if it's supported and actually helps here.
+  struct perf_event_attr precise_attr = ticks_attr;
+  precise_attr.precise_ip = 2;
+  Ticks precise_skid = calibrate_skid(precise_attr);
+  if (precise_skid >= 0 && (skid < 0 || precise_skid < skid)) {
+    LOG(debug) << "Using precise_ip for ticks counter";
+    ticks_attr.precise_ip = precise_attr.precise_ip;
+    skid = precise_skid;
+  }
+
+  sigaction(PerfCounters::TIME_SLICE_SIGNAL, &old_sa, nullptr);
+
+  if (skid < 0) {
+    LOG(debug) << "Skid calibration failed; using skid size " << skid_size;
+    return;
+  }
+  // Leave plenty of headroom: the skid isn't strictly bounded and
+  // overshooting makes replay diverge.
+  skid_size = min(pmu->max_skid, 2 * skid + 10);
+  LOG(debug) << "Observed max skid " << skid << "; using skid size "
+             << skid_size;
+}
+
 static void init_attributes() {
   if (attributes_initialized) {
     return;
@@ -158,7 +339,6 @@ static void init_attributes() {
   attributes_initialized = true;
 
   CpuMicroarch uarch = get_cpu_microarch();
-  const PmuConfig* pmu = nullptr;
   for (size_t i = 0; i < array_length(pmu_configs); ++i) {
     if (uarch == pmu_configs[i].uarch) {
       pmu = &pmu_configs[i];
@@ -181,6 +361,21 @@ static void init_attributes() {
   hw_interrupts_attr.exclude_hv = 1;
   init_perf_event_attr(&page_faults_attr, PERF_TYPE_SOFTWARE,
                        PERF_COUNT_SW_PAGE_FAULTS);
+
+  // The calibrated skid size comes from a short sample of rr's own code,
+  // which doesn't bound the skid of arbitrary tracee code, so it's only
+  // used when asked for.
+  skid_size = pmu->max_skid;
+  if (Flags::get().calibrate_skid) {
+    calibrate_skid_size();
+  }
+
+  check_for_ioc_period_bug();
+}
+
+Ticks PerfCounters::skid_size() {
+  init_attributes();
+  return rr::skid_size;
 }
 
 const struct perf_event_attr& PerfCounters::ticks_attr() {
@@ -192,34 +387,59 @@ PerfCounters::PerfCounters(pid_t tid) : tid(tid), started(false) {
   init_attributes();
 }
 
-static ScopedFd start_counter(pid_t tid, int group_fd,
-                              struct perf_event_attr* attr) {
-  int fd = syscall(__NR_perf_event_open, attr, tid, -1, group_fd, 0);
-  if (0 > fd) {
-    if (errno == EACCES) {
-      FATAL() << "Permission denied to use 'perf_event_open'; are perf events "
-                 "enabled? Try 'perf record'.";
+void PerfCounters::reset(Ticks ticks_period) {
+  assert(ticks_period >= 0);
+
+  if (fd_ticks.is_open() && !has_ioc_period_bug) {
+    // Reprogram the existing counters instead of reopening them, which
+    // saves perf_event_open, the fcntls and close.
+    uint64_t period = ticks_period;
+    if (ioctl(fd_ticks, PERF_EVENT_IOC_PERIOD, &period) ||
+        ioctl(fd_ticks, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP) ||
+        ioctl(fd_ticks, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP)) {
+      FATAL() << "Failed to reset counters";
     }
-    if (errno == ENOENT) {
-      FATAL() << "Unable to open performance counter with 'perf_event_open'; "
-                 "are perf events enabled? Try 'perf record'.";
+    started = true;
+    open_sets.splice(open_sets.end(), open_sets, open_sets_entry);
+    return;
+  }
+
+  close();
+  close_stopped_counter_sets(MAX_OPEN_COUNTER_SETS - 1);
+  open_counters(ticks_period);
+  open_sets_entry = open_sets.insert(open_sets.end(), this);
+}
+
+void PerfCounters::close_stopped_counter_sets(size_t max_open) {
+  auto it = open_sets.begin();
+  while (open_sets.size() > max_open && it != open_sets.end()) {
+    PerfCounters* counters = *it;
+    ++it;
+    if (!counters->started) {
+      counters->close();
     }
-    FATAL() << "Failed to initialize counter";
   }
-  if (ioctl(fd, PERF_EVENT_IOC_ENABLE, 0)) {
-    FATAL() << "Failed to start counter";
+}
+
+ScopedFd PerfCounters::open_counter(int group_fd,
+                                    struct perf_event_attr* attr) {
+  bool out_of_fds = false;
+  ScopedFd fd = start_counter(tid, group_fd, attr, &out_of_fds);
+  if (out_of_fds) {
+    // Give back the fds of every stopped task and try once more. If that
+    // still isn't enough, there are too many running tasks for our fd limit.
+    LOG(debug) << "Out of fds opening counters for " << tid
+               << "; closing all stopped counter sets";
+    close_stopped_counter_sets(0);
+    fd = start_counter(tid, group_fd, attr);
   }
   return fd;
 }
 
-void PerfCounters::reset(Ticks ticks_period) {
-  assert(ticks_period >= 0);
-
-  stop();
-
+void PerfCounters::open_counters(Ticks ticks_period) {
   struct perf_event_attr attr = rr::ticks_attr;
   attr.sample_period = ticks_period;
-  fd_ticks = start_counter(tid, -1, &attr);
+  fd_ticks = open_counter(-1, &attr);
 
   struct f_owner_ex own;
   own.type = F_OWNER_TID;
@@ -235,10 +455,10 @@ void PerfCounters::reset(Ticks ticks_period) {
 
   if (extra_perf_counters_enabled()) {
     int group_leader = fd_ticks;
-    fd_hw_interrupts = start_counter(tid, group_leader, &hw_interrupts_attr);
+    fd_hw_interrupts = open_counter(group_leader, &hw_interrupts_attr);
     fd_instructions_retired =
-        start_counter(tid, group_leader, &instructions_retired_attr);
-    fd_page_faults = start_counter(tid, group_leader, &page_faults_attr);
+        open_counter(group_leader, &instructions_retired_attr);
+    fd_page_faults = open_counter(group_leader, &page_faults_attr);
   }
 
   started = true;
@@ -250,6 +470,17 @@ void PerfCounters::stop() {
   }
   started = false;
 
+  if (ioctl(fd_ticks, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP)) {
+    FATAL() << "Failed to stop counters";
+  }
+}
+
+void PerfCounters::close() {
+  started = false;
+
+  if (fd_ticks.is_open()) {
+    open_sets.erase(open_sets_entry);
+  }
   fd_ticks.close();
   fd_page_faults.close();
   fd_hw_interrupts.close();
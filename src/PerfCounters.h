@@ -11,6 +11,8 @@
 #include <stdint.h>
 #include <sys/types.h>
 
+#include <list>
+
 #include "ScopedFd.h"
 #include "Ticks.h"
 
@@ -36,7 +38,7 @@ public:
    * Create performance counters monitoring the given task.
    */
   PerfCounters(pid_t tid);
-  ~PerfCounters() { stop(); }
+  ~PerfCounters() { close(); }
 
   // Change this to 'true' to enable perf counters that may be interesting
   // for experimentation, but aren't necessary for core functionality.
@@ -48,14 +50,24 @@ public:
    * the hardware triggers its interrupt some time after that.)
    * This must be called while the task is stopped, and it must be called
    * before the task is allowed to run again.
+   * The counters are opened the first time this is called and then kept
+   * open; later calls just reprogram them. To bound rr's fd usage, only
+   * the most recently reset counter sets stay open while stopped; older
+   * stopped sets are closed and reopened on their next reset.
    */
   void reset(Ticks ticks_period);
 
+  /**
+   * Disable the counters. They will be reenabled if/when reset is called
+   * again.
+   */
+  void stop();
+
   /**
    * Close the perfcounter fds. They will be automatically reopened if/when
    * reset is called again.
    */
-  void stop();
+  void close();
 
   /**
    * Read the current value of the ticks counter.
@@ -63,7 +75,7 @@ public:
   Ticks read_ticks();
 
   /**
-   * Return the fd we last used to monitor the ticks counter.
+   * Return the fd we use to monitor the ticks counter.
    */
   int ticks_fd() const { return fd_ticks.get(); }
 
@@ -82,12 +94,28 @@ public:
 
   static const struct perf_event_attr& ticks_attr();
 
+  /**
+   * Return how far short of a target we should program a ticks interrupt
+   * so that skid doesn't take us past the target. This is the
+   * conservative per-microarchitecture maximum, unless --calibrate-skid
+   * asked us to measure it on the current CPU (which may also switch the
+   * ticks counter to precise (PEBS) sampling) before opening any counters.
+   */
+  static Ticks skid_size();
+
 private:
+  void open_counters(Ticks ticks_period);
+  ScopedFd open_counter(int group_fd, struct perf_event_attr* attr);
+  static void close_stopped_counter_sets(size_t max_open);
+
   pid_t tid;
   ScopedFd fd_ticks;
   ScopedFd fd_page_faults;
   ScopedFd fd_hw_interrupts;
   ScopedFd fd_instructions_retired;
+  // Our entry in the list of open counter sets; only valid while fd_ticks
+  // is open.
+  std::list<PerfCounters*>::iterator open_sets_entry;
   bool started;
 };
 
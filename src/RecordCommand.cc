@@ -34,6 +34,8 @@ RecordCommand RecordCommand::singleton(
     "                             tests.\n"
     "  -n, --no-syscall-buffer    disable the syscall buffer preload \n"
     "                             library even if it would otherwise be used\n"
+    "  --async-trace-writes       write trace data from a separate I/O\n"
+    "                             thread, with O_DIRECT where supported\n"
     "  --no-file-cloning          disable file cloning for mmapped files\n"
     "  --no-read-cloning          disable file-block cloning for syscallbuf\n"
     "                             reads\n"
@@ -95,6 +97,9 @@ struct RecordFlags {
    * recording. */
   bool wait_for_all;
 
+  /* How trace substream files are written. */
+  CompressedWriter::IoMode trace_io_mode;
+
   RecordFlags()
       : max_ticks(Scheduler::DEFAULT_MAX_TICKS),
         ignore_sig(0),
@@ -106,7 +111,8 @@ struct RecordFlags {
         bind_cpu(RecordSession::BIND_CPU),
         always_switch(false),
         chaos(false),
-        wait_for_all(false) {}
+        wait_for_all(false),
+        trace_io_mode(CompressedWriter::BLOCKING_IO) {}
 };
 
 static bool parse_record_arg(std::vector<std::string>& args,
@@ -119,6 +125,7 @@ static bool parse_record_arg(std::vector<std::string>& args,
     { 0, "no-read-cloning", NO_PARAMETER },
     { 1, "no-file-cloning", NO_PARAMETER },
     { 2, "syscall-buffer-size", HAS_PARAMETER },
+    { 3, "async-trace-writes", NO_PARAMETER },
     { 'b', "force-syscall-buffer", NO_PARAMETER },
     { 'c', "num-cpu-ticks", HAS_PARAMETER },
     { 'h', "chaos", NO_PARAMETER },
@@ -172,6 +179,9 @@ static bool parse_record_arg(std::vector<std::string>& args,
       }
       flags.syscall_buffer_size = opt.int_value * 1024;
       break;
+    case 3:
+      flags.trace_io_mode = CompressedWriter::ASYNC_DIRECT_IO;
+      break;
     case 's':
       flags.always_switch = true;
       break;
@@ -248,8 +258,9 @@ static void setup_session_from_flags(RecordSession& session,
 static int record(const vector<string>& args, const RecordFlags& flags) {
   LOG(info) << "Start recording...";
 
-  auto session = RecordSession::create(
-      args, flags.extra_env, flags.use_syscall_buffer, flags.bind_cpu);
+  auto session =
+      RecordSession::create(args, flags.extra_env, flags.use_syscall_buffer,
+                            flags.bind_cpu, flags.trace_io_mode);
   setup_session_from_flags(*session, flags);
 
   // Install signal handlers after creating the session, to ensure they're not
@@ -266,6 +277,7 @@ static int record(const vector<string>& args, const RecordFlags& flags) {
   } while (step_result.status == RecordSession::STEP_CONTINUE && !term_request);
 
   session->terminate_recording();
+  session->write_statistics_file();
 
   switch (step_result.status) {
     case RecordSession::STEP_CONTINUE:
@@ -2,6 +2,7 @@
 
 #include "RecordSession.h"
 
+#include <inttypes.h>
 #include <limits.h>
 
 #include <algorithm>
@@ -1318,7 +1319,8 @@ static string find_syscall_buffer_library() {
 
 /*static*/ RecordSession::shr_ptr RecordSession::create(
     const vector<string>& argv, const vector<string>& extra_env,
-    SyscallBuffering syscallbuf, BindCPU bind_cpu) {
+    SyscallBuffering syscallbuf, BindCPU bind_cpu,
+    CompressedWriter::IoMode trace_io_mode) {
   // The syscallbuf library interposes some critical
   // external symbols like XShmQueryExtension(), so we
   // preload it whether or not syscallbuf is enabled. Indicate here whether
@@ -1392,15 +1394,17 @@ static string find_syscall_buffer_library() {
   // it is useless when running under rr.
   env.push_back("MOZ_GDB_SLEEP=0");
 
-  shr_ptr session(new RecordSession(argv, env, cwd, syscallbuf, bind_cpu));
+  shr_ptr session(
+      new RecordSession(argv, env, cwd, syscallbuf, bind_cpu, trace_io_mode));
   return session;
 }
 
 RecordSession::RecordSession(const std::vector<std::string>& argv,
                              const std::vector<std::string>& envp,
                              const string& cwd, SyscallBuffering syscallbuf,
-                             BindCPU bind_cpu)
-    : trace_out(argv, envp, cwd, choose_cpu(bind_cpu)),
+                             BindCPU bind_cpu,
+                             CompressedWriter::IoMode trace_io_mode)
+    : trace_out(argv, envp, cwd, choose_cpu(bind_cpu), trace_io_mode),
       scheduler_(*this),
       ignore_sig(0),
       continue_through_sig(0),
@@ -1410,7 +1414,13 @@ RecordSession::RecordSession(const std::vector<std::string>& argv,
       use_file_cloning_(true),
       use_read_cloning_(true),
       enable_chaos_(false),
-      wait_for_all_(false) {
+      wait_for_all_(false),
+      syscallbuf_flushes(0) {
+  last_live_stats.time = monotonic_now_sec();
+  last_live_stats.events = 0;
+  last_live_stats.ptrace_stops = 0;
+  last_live_stats.syscallbuf_flushes = 0;
+
   ScopedFd error_fd = create_spawn_task_error_pipe();
   RecordTask* t =
       static_cast<RecordTask*>(Task::spawn(*this, error_fd, trace_out));
@@ -1425,6 +1435,78 @@ bool RecordSession::can_end() {
   return initial_task_group->task_set().empty();
 }
 
+// How often a recording rewrites its live statistics file.
+static const double LIVE_STATS_INTERVAL_SEC = 1.0;
+
+double RecordSession::live_stats_deadline() const {
+  return last_live_stats.time + LIVE_STATS_INTERVAL_SEC;
+}
+
+/**
+ * Write counters that let users watch the overhead of a long-running
+ * recording (see 'rr stats'). Each line is a name followed by the
+ * counter's total and its rate per second over the last interval.
+ * We write a temporary file and rename it so readers never see a partial
+ * file.
+ */
+void RecordSession::update_live_stats() {
+  double now = monotonic_now_sec();
+  double interval = now - last_live_stats.time;
+  if (interval < LIVE_STATS_INTERVAL_SEC) {
+    return;
+  }
+
+  LiveStatsSample sample;
+  sample.time = now;
+  sample.events = trace_out.time();
+  sample.ptrace_stops = statistics().ptrace_stops;
+  sample.syscallbuf_flushes = syscallbuf_flushes;
+  for (auto& p : task_map) {
+    sample.ticks[p.first] = p.second->tick_count();
+  }
+
+  string path = TraceStream::live_stats_path(trace_out.dir());
+  string tmp_path = path + ".tmp";
+  FILE* out = fopen(tmp_path.c_str(), "w");
+  if (!out) {
+    LOG(warn) << "Can't write live statistics to " << tmp_path;
+    last_live_stats = sample;
+    return;
+  }
+  fprintf(out, "rr_pid %d\n", getpid());
+  fprintf(out, "updated %lld\n", (long long)time(nullptr));
+  fprintf(out, "interval_sec %.3f\n", interval);
+  fprintf(out, "events %lld %.1f\n", (long long)sample.events,
+          (sample.events - last_live_stats.events) / interval);
+  fprintf(out, "ptrace_stops %" PRIu64 " %.1f\n", sample.ptrace_stops,
+          (sample.ptrace_stops - last_live_stats.ptrace_stops) / interval);
+  fprintf(out, "syscallbuf_flushes %" PRIu64 " %.1f\n",
+          sample.syscallbuf_flushes,
+          (sample.syscallbuf_flushes - last_live_stats.syscallbuf_flushes) /
+              interval);
+  for (int s = TraceStream::SUBSTREAM_FIRST; s < TraceStream::SUBSTREAM_COUNT;
+       ++s) {
+    auto st = trace_out.stats((TraceStream::Substream)s);
+    fprintf(out, "substream %s uncompressed_bytes %" PRIu64
+                 " compressed_bytes %" PRIu64 " queue_depth %" PRIu64
+                 " producer_stall_sec %.3f level %d\n",
+            TraceStream::substream_name((TraceStream::Substream)s),
+            st.uncompressed_bytes, st.bytes_written, st.queue_depth,
+            st.producer_stall_sec, st.level);
+  }
+  for (auto& p : sample.ticks) {
+    auto last = last_live_stats.ticks.find(p.first);
+    Ticks last_ticks = last == last_live_stats.ticks.end() ? 0 : last->second;
+    fprintf(out, "task %d ticks %" PRId64 " %.1f\n", p.first, p.second,
+            (p.second - last_ticks) / interval);
+  }
+  fclose(out);
+  if (rename(tmp_path.c_str(), path.c_str())) {
+    LOG(warn) << "Can't rename " << tmp_path << " to " << path;
+  }
+  last_live_stats = sample;
+}
+
 RecordSession::RecordResult RecordSession::record_step() {
   RecordResult result;
 
@@ -1434,6 +1516,8 @@ RecordSession::RecordResult RecordSession::record_step() {
     return result;
   }
 
+  update_live_stats();
+
   result.status = STEP_CONTINUE;
 
   RecordTask* prev_task = scheduler().current();
@@ -1547,6 +1631,8 @@ void RecordSession::terminate_recording() {
                    t ? t->tick_count() : 0);
   trace_out.write_frame(frame);
   trace_out.close();
+  // The live statistics are only meaningful while we're recording.
+  unlink(TraceStream::live_stats_path(trace_out.dir()).c_str());
 }
 
 Task* RecordSession::new_task(pid_t tid, pid_t, uint32_t serial,
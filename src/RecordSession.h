@@ -3,6 +3,7 @@
 #ifndef RR_RECORD_SESSION_H_
 #define RR_RECORD_SESSION_H_
 
+#include <map>
 #include <string>
 #include <vector>
 
@@ -30,7 +31,8 @@ public:
       const std::vector<std::string>& argv,
       const std::vector<std::string>& extra_env = std::vector<std::string>(),
       SyscallBuffering syscallbuf = ENABLE_SYSCALL_BUF,
-      BindCPU bind_cpu = BIND_CPU);
+      BindCPU bind_cpu = BIND_CPU,
+      CompressedWriter::IoMode trace_io_mode = CompressedWriter::BLOCKING_IO);
 
   bool use_syscall_buffer() const { return use_syscall_buffer_; }
   size_t syscall_buffer_size() const { return syscall_buffer_size_; }
@@ -115,10 +117,22 @@ public:
   RecordTask* find_task(pid_t rec_tid) const;
   RecordTask* find_task(const TaskUid& tuid) const;
 
+  void accumulate_syscallbuf_flush() { ++syscallbuf_flushes; }
+
+  /**
+   * Rewrite the live statistics file if it's due (see 'rr stats').
+   */
+  void update_live_stats();
+  /**
+   * When the live statistics file is next due to be rewritten.
+   */
+  double live_stats_deadline() const;
+
 private:
   RecordSession(const std::vector<std::string>& argv,
                 const std::vector<std::string>& envp, const std::string& cwd,
-                SyscallBuffering syscallbuf, BindCPU bind_cpu);
+                SyscallBuffering syscallbuf, BindCPU bind_cpu,
+                CompressedWriter::IoMode trace_io_mode);
 
   virtual void on_create(Task* t);
 
@@ -155,6 +169,20 @@ private:
    * When true, wait for all tracees to exit before finishing recording.
    */
   bool wait_for_all_;
+
+  uint64_t syscallbuf_flushes;
+  /**
+   * Counters as of the last time we wrote the live statistics file, so we
+   * can report rates over the last interval.
+   */
+  struct LiveStatsSample {
+    double time;
+    TraceFrame::Time events;
+    uint64_t ptrace_stops;
+    uint64_t syscallbuf_flushes;
+    std::map<pid_t, Ticks> ticks;
+  };
+  LiveStatsSample last_live_stats;
 };
 
 } // namespace rr
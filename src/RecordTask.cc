@@ -1130,6 +1130,7 @@ void RecordTask::maybe_flush_syscallbuf() {
   }
   record_current_event();
   pop_event(EV_SYSCALLBUF_FLUSH);
+  session().accumulate_syscallbuf_flush();
 
   flushed_syscallbuf = true;
   flushed_num_rec_bytes = hdr.num_rec_bytes;
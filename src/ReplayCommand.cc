@@ -56,6 +56,10 @@ ReplayCommand ReplayCommand::singleton(
     "  -t, --trace=<EVENT>        singlestep instructions and dump register\n"
     "                             states when replaying towards <EVENT> or\n"
     "                             later\n"
+    "  -u, --unwind-return-addresses\n"
+    "                             use .eh_frame unwind info to find return\n"
+    "                             addresses when checking for reverse-\n"
+    "                             execution breakpoints\n"
     "  -x, --gdb-x=<FILE>         execute gdb commands from <FILE>\n");
 
 struct ReplayFlags {
@@ -94,6 +98,9 @@ struct ReplayFlags {
   /* When true, echo tracee stdout/stderr writes to console. */
   bool redirect;
 
+  /* When true, compute return addresses from .eh_frame unwind info. */
+  bool unwind_return_addresses;
+
   ReplayFlags()
       : goto_event(0),
         singlestep_to_event(0),
@@ -102,7 +109,8 @@ struct ReplayFlags {
         dont_launch_debugger(false),
         dbg_port(-1),
         gdb_binary_file_path("gdb"),
-        redirect(true) {}
+        redirect(true),
+        unwind_return_addresses(false) {}
 };
 
 static bool parse_replay_arg(std::vector<std::string>& args,
@@ -120,6 +128,7 @@ static bool parse_replay_arg(std::vector<std::string>& args,
     { 'q', "no-redirect-output", NO_PARAMETER },
     { 'f', "onfork", HAS_PARAMETER },
     { 'p', "onprocess", HAS_PARAMETER },
+    { 'u', "unwind-return-addresses", NO_PARAMETER },
     { 'x', "gdb-x", HAS_PARAMETER }
   };
   ParsedOption opt;
@@ -175,6 +184,9 @@ static bool parse_replay_arg(std::vector<std::string>& args,
       }
       flags.singlestep_to_event = opt.int_value;
       break;
+    case 'u':
+      flags.unwind_return_addresses = true;
+      break;
     case 'x':
       flags.gdb_command_file_path = opt.value;
       break;
@@ -239,6 +251,7 @@ static pid_t waiting_for_child;
 static ReplaySession::Flags session_flags(ReplayFlags flags) {
   ReplaySession::Flags result;
   result.redirect_stdio = flags.redirect;
+  result.unwind_return_addresses = flags.unwind_return_addresses;
   return result;
 }
 
@@ -296,6 +309,7 @@ static void serve_replay_no_debugger(const string& trace_dir,
     assert(cmd == RUN_SINGLESTEP || !result.break_status.singlestep_complete);
   }
 
+  replay_session->write_statistics_file();
   LOG(info) << ("Replayer successfully finished.");
 }
 
@@ -27,8 +27,9 @@ namespace rr {
  * there's a variable slack region, which is technically unbounded.
  * This means that an interrupt programmed for retired branch k might
  * fire at |k + 50|, for example.  To counteract the slack, we program
- * interrupts just short of our target, by the |SKID_SIZE| region
- * below, and then more slowly advance to the real target.
+ * interrupts just short of our target, by the |skid_size| region
+ * (see PerfCounters::skid_size()), and then more slowly advance to the
+ * real target.
  *
  * How was this magic number determined?  Trial and error: we want it
  * to be as small as possible for efficiency, but not so small that
@@ -38,27 +39,27 @@ namespace rr {
  * observed during replay.  Running with DEBUGLOG enabled (see above),
  * a sequence of log messages like the following will appear
  *
- * 1. programming interrupt for [target - SKID_SIZE] ticks
+ * 1. programming interrupt for [target - skid_size] ticks
  * 2. Error: Replay diverged.  Dumping register comparison.
  * 3. Error: [list of divergent registers; arbitrary]
  * 4. Error: overshot target ticks=[target] by [i]
  *
  * The key is that no other replayer log messages occur between (1)
  * and (2).  This spew means that the replayer programmed an interrupt
- * for ticks=[target-SKID_SIZE], but the tracee was actually interrupted
+ * for ticks=[target-skid_size], but the tracee was actually interrupted
  * at ticks=[target+i].  And that in turn means that the kernel/HW
  * skidded too far past the programmed target for rr to handle it.
  *
- * If that occurs, the SKID_SIZE needs to be increased by at least
- * [i].
+ * If that occurs, the max_skid for the CPU in PerfCounters.cc needs to be
+ * increased by at least [i]. PerfCounters calibrates the skid on the
+ * running CPU and uses a smaller skid size when it can, but never a
+ * larger one than that.
  *
  * NB: there are probably deeper reasons for the target slack that
  * could perhaps let it be deduced instead of arrived at empirically;
  * perhaps pipeline depth and things of that nature are involved.  But
  * those reasons if they exit are currently not understood.
  */
-static const int SKID_SIZE = 70;
-
 static void debug_memory(ReplayTask* t) {
   if (should_dump_memory(t->current_trace_frame())) {
     dump_process_memory(t, t->current_trace_frame().time(), "rep");
@@ -199,7 +200,8 @@ static bool compute_ticks_request(
     TicksRequest* ticks_request) {
   *ticks_request = RESUME_UNLIMITED_TICKS;
   if (constraints.ticks_target > 0) {
-    Ticks ticks_period = constraints.ticks_target - SKID_SIZE - t->tick_count();
+    Ticks ticks_period = constraints.ticks_target -
+                         PerfCounters::skid_size() - t->tick_count();
     if (ticks_period <= 0) {
       // Behave as if we actually executed something. Callers assume we did.
       t->clear_wait_status();
@@ -496,12 +498,13 @@ Completion ReplaySession::emulate_async_signal(
   LOG(debug) << "advancing " << ticks_left << " ticks to reach " << ticks << "/"
              << ip;
 
+  Ticks skid_size = PerfCounters::skid_size();
   /* XXX should we only do this if (ticks > 10000)? */
-  while (ticks_left - SKID_SIZE > SKID_SIZE) {
-    LOG(debug) << "  programming interrupt for " << (ticks_left - SKID_SIZE)
+  while (ticks_left - skid_size > skid_size) {
+    LOG(debug) << "  programming interrupt for " << (ticks_left - skid_size)
                << " ticks";
 
-    continue_or_step(t, constraints, (TicksRequest)(ticks_left - SKID_SIZE));
+    continue_or_step(t, constraints, (TicksRequest)(ticks_left - skid_size));
     guard_unexpected_signal(t);
 
     ticks_left = ticks - t->tick_count();
@@ -535,9 +538,19 @@ Completion ReplaySession::emulate_async_signal(
    *
    * What we really want to do is set a (precise)
    * retired-instruction interrupt and do away with all this
-   * cruft. */
+   * cruft.
+   *
+   * If the target $ip is in a loop, we hit the internal breakpoint once
+   * per iteration. Once we've seen two consecutive hits we know how many
+   * ticks an iteration takes, and if programming a ticks interrupt would
+   * skip at least two iterations we do that instead of crawling through
+   * them one breakpoint hit at a time. */
   Registers mismatched_regs;
   const Registers* mismatched_regs_ptr = NULL;
+  // tick_count() when we last hit the internal breakpoint, or -1
+  Ticks last_target_ip_hit_ticks = -1;
+  // Ticks between the last two internal breakpoint hits, or 0
+  Ticks loop_iteration_ticks = 0;
   while (true) {
     /* Invariants here are
      *  o ticks_left is up-to-date
@@ -597,6 +610,10 @@ Completion ReplaySession::emulate_async_signal(
 
         pending_SIGTRAP = false;
         t->move_ip_before_breakpoint();
+        if (last_target_ip_hit_ticks >= 0) {
+          loop_iteration_ticks = t->tick_count() - last_target_ip_hit_ticks;
+        }
+        last_target_ip_hit_ticks = t->tick_count();
         /* We just backed up the $ip, but
          * rewound it over an |int $3|
          * instruction, which couldn't have
@@ -670,6 +687,17 @@ Completion ReplaySession::emulate_async_signal(
           t->vm()->get_breakpoint_type_at_addr(t->regs().ip()) == BKPT_USER) {
         continue_or_step(t, constraints, RESUME_UNLIMITED_TICKS);
         SIGTRAP_run_command = constraints.command;
+      } else if (loop_iteration_ticks > 0 &&
+                 ticks_left - skid_size >= 2 * loop_iteration_ticks) {
+        LOG(debug) << "    target $ip is in a " << loop_iteration_ticks
+                   << "-tick loop; programming interrupt for "
+                   << (ticks_left - skid_size) << " ticks";
+        continue_or_step(t, constraints,
+                         (TicksRequest)(ticks_left - skid_size));
+        SIGTRAP_run_command = constraints.command;
+        // We'll stop at some arbitrary point in the loop.
+        last_target_ip_hit_ticks = -1;
+        loop_iteration_ticks = 0;
       } else {
         vector<const Registers*> states = constraints.stop_before_states;
         // This state may not be relevant if we don't have the correct tick
@@ -982,12 +1010,25 @@ void ReplaySession::check_approaching_ticks_target(
     BreakStatus& break_status) {
   if (constraints.ticks_target > 0) {
     Ticks ticks_left = constraints.ticks_target - t->tick_count();
-    if (ticks_left <= SKID_SIZE) {
+    if (ticks_left <= PerfCounters::skid_size()) {
       break_status.approaching_ticks_target = true;
     }
   }
 }
 
+/**
+ * Run until we're within the skid region of |constraints.ticks_target|,
+ * using ticks interrupts all the way. Callers (see ReplayTimeline) cover
+ * the rest, by single-stepping or with a breakpoint when they know the
+ * target $ip.
+ *
+ * The loop skip in emulate_async_signal() doesn't apply here. It measures
+ * loop iterations by hitting a breakpoint at the target $ip, which we
+ * don't have, and all it gains is replacing breakpoint hits above
+ * |ticks_target - skid_size| with a ticks interrupt. We already program
+ * interrupts down to that point, and below it an interrupt could
+ * overshoot the target.
+ */
 Completion ReplaySession::advance_to_ticks_target(
     ReplayTask* t, const StepConstraints& constraints) {
   while (true) {
@@ -268,11 +268,14 @@ public:
   static bool is_ignored_signal(int sig);
 
   struct Flags {
-    Flags() : redirect_stdio(false) {}
+    Flags() : redirect_stdio(false), unwind_return_addresses(false) {}
     Flags(const Flags& other) = default;
     bool redirect_stdio;
+    // Compute ReturnAddressLists using .eh_frame unwind info.
+    bool unwind_return_addresses;
   };
   bool redirect_stdio() { return flags.redirect_stdio; }
+  bool unwind_return_addresses() { return flags.unwind_return_addresses; }
 
   void set_flags(const Flags& flags) { this->flags = flags; }
 
@@ -111,19 +111,17 @@ const TraceFrame& ReplayTask::current_trace_frame() {
 }
 
 ssize_t ReplayTask::set_data_from_trace() {
-  auto buf = trace_reader().read_raw_data();
-  if (!buf.addr.is_null() && buf.data.size() > 0) {
-    write_bytes_helper(buf.addr, buf.data.size(), buf.data.data());
-  }
-  return buf.data.size();
+  return trace_reader().read_raw_data_in_place(
+      [this](remote_ptr<void> addr, const uint8_t* data, size_t len) {
+        write_bytes_helper(addr, len, data);
+      });
 }
 
 void ReplayTask::apply_all_data_records_from_trace() {
-  TraceReader::RawData buf;
-  while (trace_reader().read_raw_data_for_frame(current_trace_frame(), buf)) {
-    if (!buf.addr.is_null() && buf.data.size() > 0) {
-      write_bytes_helper(buf.addr, buf.data.size(), buf.data.data());
-    }
+  auto consumer = [this](remote_ptr<void> addr, const uint8_t* data,
+                         size_t len) { write_bytes_helper(addr, len, data); };
+  while (trace_reader().read_raw_data_for_frame_in_place(current_trace_frame(),
+                                                         consumer)) {
   }
 }
 
@@ -2,6 +2,8 @@
 
 #include "ReturnAddressList.h"
 
+#include "EhFrameUnwinder.h"
+#include "ReplaySession.h"
 #include "Task.h"
 
 namespace rr {
@@ -40,6 +42,11 @@ static void compute_return_addresses(ReturnAddressList* result, Task* t) {
 }
 
 ReturnAddressList::ReturnAddressList(Task* t) {
+  ReplaySession* replay = t->session().as_replay();
+  if (replay && replay->unwind_return_addresses() &&
+      t->vm()->eh_frame_unwinder().unwind(t, addresses, COUNT) > 0) {
+    return;
+  }
   compute_return_addresses(this, t);
 }
 
@@ -17,6 +17,7 @@
 
 #include <algorithm>
 
+#include "ChildWaiter.h"
 #include "Flags.h"
 #include "log.h"
 #include "RecordSession.h"
@@ -172,9 +173,9 @@ bool Scheduler::is_task_runnable(RecordTask* t, bool* by_waitpid) {
 
   LOG(debug) << "  " << t->tid << " is blocked on " << t->ev()
              << "; checking status ...";
-  bool did_wait_for_t;
-  did_wait_for_t = t->try_wait();
-  if (did_wait_for_t) {
+  WaitStatus status;
+  if (take_wait_status(t->tid, &status)) {
+    t->did_waitpid(status);
     *by_waitpid = true;
     must_run_task = t;
     LOG(debug) << "  ready with status " << t->status();
@@ -185,6 +186,48 @@ bool Scheduler::is_task_runnable(RecordTask* t, bool* by_waitpid) {
   return false;
 }
 
+void Scheduler::drain_wait_statuses() {
+  while (true) {
+    int raw_status = 0;
+    pid_t tid = waitpid(-1, &raw_status, WNOHANG | __WALL | WSTOPPED);
+    if (tid == 0 || (tid < 0 && (errno == ECHILD || errno == EINTR))) {
+      return;
+    }
+    if (tid < 0) {
+      FATAL() << "Failed to waitpid(-1, NOHANG)";
+    }
+    WaitStatus status(raw_status);
+    LOG(debug) << "  drained status " << status << " for " << tid;
+    if (!session.find_task(tid) && (status.type() == WaitStatus::EXIT ||
+                                    status.type() == WaitStatus::FATAL_SIGNAL)) {
+      // The task is already gone; nobody will ask for this. (A stop for an
+      // unknown tid is a new clone child's initial stop, which we keep.)
+      LOG(debug) << "    ... but it's dead";
+      continue;
+    }
+    wait_statuses.insert(make_pair(tid, status));
+  }
+}
+
+bool Scheduler::take_wait_status(pid_t tid, WaitStatus* status) {
+  auto it = wait_statuses.find(tid);
+  if (it == wait_statuses.end()) {
+    return false;
+  }
+  *status = it->second;
+  wait_statuses.erase(it);
+  return true;
+}
+
+bool Scheduler::peek_wait_status(pid_t tid, WaitStatus* status) const {
+  auto it = wait_statuses.find(tid);
+  if (it == wait_statuses.end()) {
+    return false;
+  }
+  *status = it->second;
+  return true;
+}
+
 RecordTask* Scheduler::find_next_runnable_task(RecordTask* t, bool* by_waitpid,
                                                int priority_threshold) {
   *by_waitpid = false;
@@ -359,6 +402,8 @@ Scheduler::Rescheduled Scheduler::reschedule(Switchable switchable) {
     return result;
   }
 
+  drain_wait_statuses();
+
   RecordTask* next;
   while (true) {
     maybe_reset_high_priority_only_intervals(now);
@@ -435,11 +480,28 @@ Scheduler::Rescheduled Scheduler::reschedule(Switchable switchable) {
 
     LOG(debug) << "  all tasks blocked or some unstable, waiting for runnable ("
                << task_priority_set.size() << " total)";
-    do {
-      int raw_status;
-      tid = waitpid(-1, &raw_status, __WALL | WSTOPPED | WUNTRACED);
-      status = WaitStatus(raw_status);
+    next = nullptr;
+    // Statuses we already collected for tasks that weren't eligible to run
+    // (e.g. ptrace-stopped tasks) would otherwise be reported here.
+    for (auto it = wait_statuses.begin(); it != wait_statuses.end(); ++it) {
+      next = session.find_task(it->first);
+      if (next) {
+        status = it->second;
+        wait_statuses.erase(it);
+        LOG(debug) << "  " << next->tid << " has cached status " << status;
+        break;
+      }
+    }
+    while (!next) {
+      // Wake up now and then to keep the live statistics fresh while
+      // every task is blocked, e.g. in a long sleep.
+      tid = ChildWaiter::wait(-1, __WALL | WSTOPPED | WUNTRACED, &status,
+                              session.live_stats_deadline());
       now = -1; // invalid, don't use
+      if (0 == tid) {
+        session.update_live_stats();
+        continue;
+      }
       if (-1 == tid) {
         if (EINTR == errno) {
           LOG(debug) << "  waitpid(-1) interrupted";
@@ -453,9 +515,15 @@ Scheduler::Rescheduled Scheduler::reschedule(Switchable switchable) {
 
       next = session.find_task(tid);
       if (!next) {
-        LOG(debug) << "    ... but it's dead";
+        if (status.type() == WaitStatus::EXIT ||
+            status.type() == WaitStatus::FATAL_SIGNAL) {
+          LOG(debug) << "    ... but it's dead";
+        } else {
+          LOG(debug) << "    ... but its task doesn't exist yet";
+          wait_statuses.insert(make_pair(tid, status));
+        }
       }
-    } while (!next);
+    }
     ASSERT(next, next->unstable || next->may_be_blocked() ||
                      status.ptrace_event() == PTRACE_EVENT_EXIT)
         << "Scheduled task should have been blocked or unstable";
@@ -522,6 +590,8 @@ void Scheduler::on_destroy(RecordTask* t) {
   if (t == current_) {
     current_ = nullptr;
   }
+  // Don't hand stale statuses to a future task that reuses this tid.
+  wait_statuses.erase(t->tid);
 
   if (t->in_round_robin_queue) {
     auto iter =
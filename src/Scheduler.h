@@ -4,11 +4,13 @@
 #define RR_REC_SCHED_H_
 
 #include <deque>
+#include <map>
 #include <set>
 
 #include "Ticks.h"
 #include "TraceFrame.h"
 #include "util.h"
+#include "WaitStatus.h"
 
 namespace rr {
 
@@ -52,6 +54,12 @@ class RecordTask;
  *
  * The main parameter to the scheduler is |max_ticks|, which controls the
  * length of each timeslice.
+ *
+ * To find out which blocked tasks have changed state, each reschedule drains
+ * all pending statuses with waitpid(-1, WNOHANG) and caches them per tid,
+ * instead of calling waitpid on every blocked task. Task::wait() and
+ * Task::try_wait() consume cached statuses before calling waitpid
+ * themselves.
  */
 class Scheduler {
 public:
@@ -134,6 +142,16 @@ public:
 
   void in_stable_exit(RecordTask* t);
 
+  /**
+   * If a wait status for |tid| was collected by draining waitpid(-1),
+   * remove it from the cache, store it in |status| and return true.
+   */
+  bool take_wait_status(pid_t tid, WaitStatus* status);
+  /**
+   * Like take_wait_status, but leaves the status in the cache.
+   */
+  bool peek_wait_status(pid_t tid, WaitStatus* status) const;
+
 private:
   // Tasks sorted by priority.
   typedef std::set<std::pair<int, RecordTask*> > TaskPrioritySet;
@@ -167,6 +185,10 @@ private:
   bool in_high_priority_only_interval(double now);
   bool treat_as_high_priority(RecordTask* t);
   bool is_task_runnable(RecordTask* t, bool* by_waitpid);
+  /**
+   * Collect all pending wait statuses without blocking.
+   */
+  void drain_wait_statuses();
 
   RecordSession& session;
 
@@ -219,6 +241,13 @@ private:
   bool last_reschedule_in_high_priority_only_interval;
 
   RecordTask* must_run_task;
+
+  /**
+   * Wait statuses collected by drain_wait_statuses() that haven't been
+   * consumed yet, in the order they were reported. This can include the
+   * initial stop of a new clone child whose Task hasn't been created yet.
+   */
+  std::multimap<pid_t, WaitStatus> wait_statuses;
 };
 
 } // namespace rr
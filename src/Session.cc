@@ -2,6 +2,7 @@
 
 #include "Session.h"
 
+#include <inttypes.h>
 #include <syscall.h>
 #include <sys/prctl.h>
 
@@ -11,6 +12,7 @@
 
 #include "AutoRemoteSyscalls.h"
 #include "EmuFs.h"
+#include "Flags.h"
 #include "kernel_metadata.h"
 #include "log.h"
 #include "Task.h"
@@ -277,6 +279,23 @@ string Session::read_spawned_task_error() const {
   return string(buf, len);
 }
 
+void Session::write_statistics_file() {
+  const string& path = Flags::get().statistics_file;
+  if (path.empty()) {
+    return;
+  }
+  FILE* out = fopen(path.c_str(), "w");
+  if (!out) {
+    FATAL() << "Can't open statistics file " << path;
+  }
+  fprintf(out, "{\"ticks\": %" PRId64 ", \"syscalls\": %" PRIu32
+               ", \"bytes_written\": %" PRIu64
+               ", \"ptrace_stops\": %" PRIu64 "}\n",
+          statistics_.ticks_processed, statistics_.syscalls_performed,
+          statistics_.bytes_written, statistics_.ptrace_stops);
+  fclose(out);
+}
+
 BreakStatus Session::diagnose_debugger_trap(Task* t, RunCommand run_command) {
   assert_fully_initialized();
   BreakStatus break_status;
@@ -371,59 +390,100 @@ void Session::finish_initializing() const {
   self->clone_completion = nullptr;
 }
 
-static void remap_shared_mmap(AutoRemoteSyscalls& remote, EmuFs& emu_fs,
-                              EmuFs& dest_emu_fs,
-                              const AddressSpace::Mapping& m_in_mem) {
-  AddressSpace::Mapping m = m_in_mem;
-
-  LOG(debug) << "    remapping shared region at " << m.map.start() << "-"
-             << m.map.end();
-  remote.infallible_syscall(syscall_number_for_munmap(remote.arch()),
-                            m.map.start(), m.map.size());
+/**
+ * Number of shared mappings remapped per batch of remote syscalls. Each one
+ * needs two syscalls per batch and a path in tracee memory.
+ */
+static const size_t REMAP_BATCH_SIZE = 8;
+
+static void remap_shared_mmaps(AutoRemoteSyscalls& remote, EmuFs& emu_fs,
+                               EmuFs& dest_emu_fs,
+                               const vector<AddressSpace::Mapping>& maps) {
+  Task* t = remote.task();
+  for (size_t begin = 0; begin < maps.size(); begin += REMAP_BATCH_SIZE) {
+    size_t end = min(maps.size(), begin + REMAP_BATCH_SIZE);
+
+    vector<EmuFile::shr_ptr> emu_files;
+    string paths;
+    vector<size_t> path_offsets;
+    for (size_t i = begin; i < end; ++i) {
+      const AddressSpace::Mapping& m = maps[i];
+      LOG(debug) << "    remapping shared region at " << m.map.start() << "-"
+                 << m.map.end();
+      EmuFile::shr_ptr emu_file;
+      if (dest_emu_fs.has_file_for(m.recorded_map)) {
+        emu_file = dest_emu_fs.at(m.recorded_map);
+      } else {
+        emu_file = dest_emu_fs.clone_file(emu_fs.at(m.recorded_map));
+      }
+      emu_files.push_back(emu_file);
+      path_offsets.push_back(paths.size());
+      paths += emu_file->proc_path();
+      paths.push_back('\0');
+    }
 
-  EmuFile::shr_ptr emu_file;
-  if (dest_emu_fs.has_file_for(m.recorded_map)) {
-    emu_file = dest_emu_fs.at(m.recorded_map);
-  } else {
-    emu_file = dest_emu_fs.clone_file(emu_fs.at(m.recorded_map));
-  }
+    // TODO: this duplicates some code in replay_syscall.cc, but
+    // it's somewhat nontrivial to factor that code out.
+    vector<int> remote_fds;
+    {
+      AutoRestoreMem child_paths(remote, paths.data(), paths.size());
+      vector<AutoRemoteSyscalls::BatchedSyscall> syscalls;
+      for (size_t i = begin; i < end; ++i) {
+        const AddressSpace::Mapping& m = maps[i];
+        syscalls.push_back(AutoRemoteSyscalls::BatchedSyscall(
+            syscall_number_for_munmap(remote.arch()), m.map.start().as_int(),
+            m.map.size()));
+        // Always open the emufs file O_RDWR, even if the current mapping prot
+        // is read-only. We might mprotect it to read-write later.
+        // skip leading '/' since we want the path to be relative to the root
+        // fd
+        syscalls.push_back(AutoRemoteSyscalls::BatchedSyscall(
+            syscall_number_for_openat(remote.arch()), RR_RESERVED_ROOT_DIR_FD,
+            (child_paths.get() + path_offsets[i - begin] + 1).as_int(),
+            O_RDWR));
+      }
+      remote.infallible_syscall_batch(syscalls);
+      for (size_t i = 1; i < syscalls.size(); i += 2) {
+        remote_fds.push_back(syscalls[i].result);
+      }
+    }
 
-  // TODO: this duplicates some code in replay_syscall.cc, but
-  // it's somewhat nontrivial to factor that code out.
-  int remote_fd;
-  {
-    string path = emu_file->proc_path();
-    AutoRestoreMem child_path(remote, path.c_str());
-    // Always open the emufs file O_RDWR, even if the current mapping prot
-    // is read-only. We might mprotect it to read-write later.
-    // skip leading '/' since we want the path to be relative to the root fd
-    remote_fd = remote.infallible_syscall(
-        syscall_number_for_openat(remote.arch()), RR_RESERVED_ROOT_DIR_FD,
-        child_path.get() + 1, O_RDWR);
-    if (0 > remote_fd) {
-      FATAL() << "Couldn't open " << path << " in tracee";
+    vector<AutoRemoteSyscalls::BatchedSyscall> syscalls;
+    vector<struct stat> real_files;
+    vector<string> real_file_names;
+    for (size_t i = begin; i < end; ++i) {
+      const AddressSpace::Mapping& m = maps[i];
+      int remote_fd = remote_fds[i - begin];
+      real_files.push_back(t->stat_fd(remote_fd));
+      real_file_names.push_back(t->file_name_of_fd(remote_fd));
+      // XXX this condition is x86/x64-specific, I imagine.
+      syscalls.push_back(remote.batched_mmap_syscall(
+          m.map.start(), m.map.size(), m.map.prot(),
+          // The remapped segment *must* be
+          // remapped at the same address,
+          // or else many things will go
+          // haywire.
+          (m.map.flags() & ~MAP_ANONYMOUS) | MAP_FIXED, remote_fd,
+          m.map.file_offset_bytes() / page_size()));
+      syscalls.push_back(AutoRemoteSyscalls::BatchedSyscall(
+          syscall_number_for_close(remote.arch()), remote_fd));
+    }
+    remote.infallible_syscall_batch(syscalls);
+
+    for (size_t i = begin; i < end; ++i) {
+      const AddressSpace::Mapping& m = maps[i];
+      remote_ptr<void> addr = syscalls[(i - begin) * 2].result;
+      ASSERT(t, addr == m.map.start()) << "MAP_FIXED at " << m.map.start()
+                                       << " but got " << addr;
+      // We update the AddressSpace mapping too, since that tracks the real
+      // file name and we need to update that.
+      const struct stat& real_file = real_files[i - begin];
+      t->vm()->map(m.map.start(), m.map.size(), m.map.prot(), m.map.flags(),
+                   m.map.file_offset_bytes(), real_file_names[i - begin],
+                   real_file.st_dev, real_file.st_ino, &m.recorded_map,
+                   emu_files[i - begin]);
     }
   }
-  struct stat real_file = remote.task()->stat_fd(remote_fd);
-  string real_file_name = remote.task()->file_name_of_fd(remote_fd);
-  // XXX this condition is x86/x64-specific, I imagine.
-  remote.infallible_mmap_syscall(m.map.start(), m.map.size(), m.map.prot(),
-                                 // The remapped segment *must* be
-                                 // remapped at the same address,
-                                 // or else many things will go
-                                 // haywire.
-                                 (m.map.flags() & ~MAP_ANONYMOUS) | MAP_FIXED,
-                                 remote_fd,
-                                 m.map.file_offset_bytes() / page_size());
-
-  // We update the AddressSpace mapping too, since that tracks the real file
-  // name and we need to update that.
-  remote.task()->vm()->map(m.map.start(), m.map.size(), m.map.prot(),
-                           m.map.flags(), m.map.file_offset_bytes(),
-                           real_file_name, real_file.st_dev, real_file.st_ino,
-                           &m.recorded_map, emu_file);
-
-  remote.infallible_syscall(syscall_number_for_close(remote.arch()), remote_fd);
 }
 
 void Session::copy_state_to(Session& dest, EmuFs& emu_fs, EmuFs& dest_emu_fs) {
@@ -448,12 +508,14 @@ void Session::copy_state_to(Session& dest, EmuFs& emu_fs, EmuFs& dest_emu_fs) {
 
     {
       AutoRemoteSyscalls remote(group.clone_leader);
+      vector<AddressSpace::Mapping> shared_maps;
       for (auto m : group.clone_leader->vm()->maps()) {
         if ((m.recorded_map.flags() & MAP_SHARED) &&
             emu_fs.has_file_for(m.recorded_map)) {
-          remap_shared_mmap(remote, emu_fs, dest_emu_fs, m);
+          shared_maps.push_back(m);
         }
       }
+      remap_shared_mmaps(remote, emu_fs, dest_emu_fs, shared_maps);
 
       for (auto t : group_leader->task_group()->task_set()) {
         if (group_leader == t) {
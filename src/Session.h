@@ -207,10 +207,15 @@ public:
 
   struct Statistics {
     Statistics()
-        : bytes_written(0), ticks_processed(0), syscalls_performed(0) {}
+        : bytes_written(0),
+          ticks_processed(0),
+          syscalls_performed(0),
+          ptrace_stops(0) {}
     uint64_t bytes_written;
     Ticks ticks_processed;
     uint32_t syscalls_performed;
+    // Number of times a tracee stopped and we waited for it.
+    uint64_t ptrace_stops;
   };
   void accumulate_bytes_written(uint64_t bytes_written) {
     statistics_.bytes_written += bytes_written;
@@ -219,7 +224,13 @@ public:
   void accumulate_ticks_processed(Ticks ticks) {
     statistics_.ticks_processed += ticks;
   }
+  void accumulate_ptrace_stop() { statistics_.ptrace_stops += 1; }
   Statistics statistics() { return statistics_; }
+  /**
+   * If the user asked for it with --statistics-file, write our statistics
+   * to that file as a single JSON object.
+   */
+  void write_statistics_file();
 
   virtual Task* new_task(pid_t tid, pid_t rec_tid, uint32_t serial,
                          SupportedArch a);
@@ -0,0 +1,147 @@
+/* -*- Mode: C++; tab-width: 8; c-basic-offset: 2; indent-tabs-mode: nil; -*- */
+
+#include <dirent.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <fstream>
+
+#include "Command.h"
+#include "main.h"
+#include "TraceStream.h"
+
+using namespace std;
+
+namespace rr {
+
+class StatsCommand : public Command {
+public:
+  virtual int run(std::vector<std::string>& args);
+
+protected:
+  StatsCommand(const char* name, const char* help) : Command(name, help) {}
+
+  static StatsCommand singleton;
+};
+
+StatsCommand StatsCommand::singleton(
+    "stats",
+    " rr stats <pid>|<trace_dir>\n"
+    "  Print the live statistics of an ongoing recording: events, ptrace\n"
+    "  stops and syscallbuf flushes (totals and rates per second), trace\n"
+    "  bytes per substream before and after compression, compression queue\n"
+    "  depths and per-thread tick rates. <pid> can be the recording rr\n"
+    "  process or any of its tracees.\n");
+
+// If live statistics are more than this old, the recording is probably
+// stuck waiting for its tracees.
+static const time_t STALE_STATS_SEC = 5;
+
+/**
+ * Find the trace directory of the recording made by rr process |pid|, by
+ * looking for the events substream among its open files.
+ */
+static string trace_dir_of_recorder(pid_t pid) {
+  char fd_dir[PATH_MAX];
+  sprintf(fd_dir, "/proc/%d/fd", pid);
+  DIR* dir = opendir(fd_dir);
+  if (!dir) {
+    return string();
+  }
+  string events_suffix = string("/") +
+                         TraceStream::substream_name(TraceStream::EVENTS);
+  string result;
+  struct dirent* d;
+  while (result.empty() && (d = readdir(dir)) != nullptr) {
+    string link_path = string(fd_dir) + "/" + d->d_name;
+    char target[PATH_MAX];
+    ssize_t len = readlink(link_path.c_str(), target, sizeof(target) - 1);
+    if (len <= 0) {
+      continue;
+    }
+    string file(target, len);
+    if (file.size() > events_suffix.size() &&
+        file.compare(file.size() - events_suffix.size(), string::npos,
+                     events_suffix) == 0) {
+      result = file.substr(0, file.size() - events_suffix.size());
+    }
+  }
+  closedir(dir);
+  return result;
+}
+
+static pid_t tracer_of(pid_t pid) {
+  char status_path[PATH_MAX];
+  sprintf(status_path, "/proc/%d/status", pid);
+  ifstream status(status_path);
+  string line;
+  while (getline(status, line)) {
+    if (line.compare(0, 10, "TracerPid:") == 0) {
+      return atoi(line.c_str() + 10);
+    }
+  }
+  return 0;
+}
+
+static string trace_dir_for_pid(pid_t pid) {
+  string trace_dir = trace_dir_of_recorder(pid);
+  if (trace_dir.empty()) {
+    pid_t tracer = tracer_of(pid);
+    if (tracer > 0) {
+      trace_dir = trace_dir_of_recorder(tracer);
+    }
+  }
+  return trace_dir;
+}
+
+static int stats(const string& trace_dir, FILE* out) {
+  string path = TraceStream::live_stats_path(trace_dir);
+  ifstream in(path);
+  if (!in) {
+    fprintf(stderr, "No live statistics in %s; is it being recorded?\n",
+            trace_dir.c_str());
+    return 1;
+  }
+  string line;
+  while (getline(in, line)) {
+    if (line.compare(0, 8, "updated ") == 0) {
+      time_t age = time(nullptr) - atoll(line.c_str() + 8);
+      if (age > STALE_STATS_SEC) {
+        fprintf(stderr, "Warning: statistics were last updated %lld seconds "
+                        "ago\n",
+                (long long)age);
+      }
+    }
+    fprintf(out, "%s\n", line.c_str());
+  }
+  return 0;
+}
+
+int StatsCommand::run(std::vector<std::string>& args) {
+  while (parse_global_option(args)) {
+  }
+
+  if (args.size() != 1 || !verify_not_option(args)) {
+    print_help(stderr);
+    return 1;
+  }
+
+  string trace_dir = args[0];
+  char* end;
+  long pid = strtol(args[0].c_str(), &end, 10);
+  if (!*end && pid > 0) {
+    trace_dir = trace_dir_for_pid(pid);
+    if (trace_dir.empty()) {
+      fprintf(stderr, "Process %ld isn't rr recording or an rr tracee\n",
+              pid);
+      return 1;
+    }
+  }
+
+  return stats(trace_dir, stdout);
+}
+
+} // namespace rr
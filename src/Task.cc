@@ -27,6 +27,7 @@
 #include "preload/preload_interface.h"
 
 #include "AutoRemoteSyscalls.h"
+#include "ChildWaiter.h"
 #include "CPUIDBugDetector.h"
 #include "kernel_abi.h"
 #include "kernel_metadata.h"
@@ -791,16 +792,28 @@ void Task::resume_execution(ResumeRequest how, WaitRequest wait_how,
      * a chance to SIGKILL our tracee and advance it to the PTRACE_EXIT_EVENT,
      * or just letting the tracee be scheduled to process its pending SIGKILL.
      */
-    int raw_status = 0;
-    wait_ret = waitpid(tid, &raw_status, WNOHANG | __WALL | WSTOPPED);
-    ASSERT(this, 0 <= wait_ret) << "waitpid(" << tid << ", NOHANG) failed with "
-                                << wait_ret;
-    WaitStatus status(raw_status);
-    if (wait_ret == tid) {
-      ASSERT(this, status.ptrace_event() == PTRACE_EVENT_EXIT);
+    Scheduler& scheduler = session().as_record()->scheduler();
+    WaitStatus status;
+    if (scheduler.peek_wait_status(tid, &status)) {
+      // The scheduler already collected this task's next stop. That's only
+      // the race above if it's the exit event; any other stop stays
+      // buffered for wait() to report.
+      if (status.ptrace_event() == PTRACE_EVENT_EXIT) {
+        scheduler.take_wait_status(tid, &status);
+        wait_ret = tid;
+      }
     } else {
-      ASSERT(this, 0 == wait_ret) << "waitpid(" << tid
+      int raw_status = 0;
+      wait_ret = waitpid(tid, &raw_status, WNOHANG | __WALL | WSTOPPED);
+      ASSERT(this, 0 <= wait_ret) << "waitpid(" << tid
                                   << ", NOHANG) failed with " << wait_ret;
+      status = WaitStatus(raw_status);
+      if (wait_ret == tid) {
+        ASSERT(this, status.ptrace_event() == PTRACE_EVENT_EXIT);
+      } else {
+        ASSERT(this, 0 == wait_ret) << "waitpid(" << tid
+                                    << ", NOHANG) failed with " << wait_ret;
+      }
     }
   }
   if (wait_ret == tid) {
@@ -1031,17 +1044,6 @@ static bool is_signal_triggered_by_ptrace_interrupt(int group_stop_sig) {
   }
 }
 
-// This function doesn't really need to do anything. The signal will cause
-// waitpid to return EINTR and that's all we need.
-static void handle_alarm_signal(__attribute__((unused)) int sig) {}
-
-static struct timeval to_timeval(double t) {
-  struct timeval v;
-  v.tv_sec = (time_t)floor(t);
-  v.tv_usec = (int)floor((t - v.tv_sec) * 1000000);
-  return v;
-}
-
 void Task::wait(double interrupt_after_elapsed) {
   LOG(debug) << "going into blocking waitpid(" << tid << ") ...";
   ASSERT(this, !unstable) << "Don't wait for unstable tasks";
@@ -1057,23 +1059,29 @@ void Task::wait(double interrupt_after_elapsed) {
   WaitStatus status;
   bool sent_wait_interrupt = false;
   pid_t ret;
-  while (true) {
-    if (interrupt_after_elapsed) {
-      struct itimerval timer = { { 0, 0 },
-                                 to_timeval(interrupt_after_elapsed) };
-      setitimer(ITIMER_REAL, &timer, nullptr);
-    }
-    int raw_status = 0;
-    ret = waitpid(tid, &raw_status, __WALL);
-    status = WaitStatus(raw_status);
-    if (interrupt_after_elapsed) {
-      struct itimerval timer = { { 0, 0 }, { 0, 0 } };
-      setitimer(ITIMER_REAL, &timer, nullptr);
-    }
-    if (ret >= 0 || errno != EINTR) {
-      // waitpid was not interrupted by the alarm.
+  bool have_cached_status =
+      session().is_recording() &&
+      session().as_record()->scheduler().take_wait_status(tid, &status);
+  if (have_cached_status) {
+    LOG(debug) << "  using status collected by the scheduler";
+    ret = tid;
+  }
+  // The deadline is absolute, so other signals interrupting the wait don't
+  // postpone it.
+  double deadline =
+      interrupt_after_elapsed ? monotonic_now_sec() + interrupt_after_elapsed
+                              : 0;
+  while (!have_cached_status) {
+    ret = ChildWaiter::wait(tid, __WALL, &status, deadline);
+    if (ret > 0 || (ret < 0 && errno != EINTR)) {
+      // We got a status, or waitpid failed.
       break;
     }
+    if (ret < 0) {
+      // Some other signal arrived; keep waiting until the deadline.
+      continue;
+    }
+    deadline = monotonic_now_sec() + interrupt_after_elapsed;
 
     if (is_zombie_process(tg->real_tgid)) {
       // The process is dead. We must stop waiting on it now
@@ -1089,7 +1097,7 @@ void Task::wait(double interrupt_after_elapsed) {
       break;
     }
 
-    if (!sent_wait_interrupt && interrupt_after_elapsed) {
+    if (!sent_wait_interrupt) {
       ptrace_if_alive(PTRACE_INTERRUPT, nullptr, nullptr);
       sent_wait_interrupt = true;
     }
@@ -1218,6 +1226,7 @@ void Task::did_waitpid(WaitStatus status, siginfo_t* override_siginfo) {
   hpc.stop();
   ticks += more_ticks;
   session().accumulate_ticks_processed(more_ticks);
+  session().accumulate_ptrace_stop();
 
   LOG(debug) << "  (refreshing register cache)";
   intptr_t original_syscallno = registers.original_syscallno();
@@ -1295,6 +1304,13 @@ void Task::did_waitpid(WaitStatus status, siginfo_t* override_siginfo) {
 }
 
 bool Task::try_wait() {
+  WaitStatus status;
+  if (session().is_recording() &&
+      session().as_record()->scheduler().take_wait_status(tid, &status)) {
+    LOG(debug) << "try_wait(" << tid << ") using cached status " << status;
+    did_waitpid(status);
+    return true;
+  }
   int raw_status = 0;
   pid_t ret = waitpid(tid, &raw_status, WNOHANG | __WALL | WSTOPPED);
   ASSERT(this, 0 <= ret) << "waitpid(" << tid << ", NOHANG) failed with "
@@ -2235,6 +2251,13 @@ static void set_up_seccomp_filter(Session& session, int err_fd) {
 
 static void run_initial_child(Session& session, const ScopedFd& error_fd,
                               const TraceStream& trace) {
+  // rr may have blocked SIGCHLD for its own waiting (see ChildWaiter);
+  // the tracee shouldn't inherit that.
+  sigset_t mask;
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGCHLD);
+  sigprocmask(SIG_UNBLOCK, &mask, nullptr);
+  restore_initial_fd_limit();
   // Set current working directory to the cwd used during
   // recording. The main effect of this is to resolve relative
   // paths in the following execvpe correctly during replay.
@@ -2313,12 +2336,6 @@ static void run_initial_child(Session& session, const ScopedFd& error_fd,
     FATAL() << "Failed to fork";
   }
 
-  struct sigaction sa;
-  sa.sa_handler = handle_alarm_signal;
-  sigemptyset(&sa.sa_mask);
-  sa.sa_flags = 0; // No SA_RESTART, so waitpid() will be interrupted
-  sigaction(SIGALRM, &sa, nullptr);
-
   // Sync with the child process.
   // We minimize the code we run between fork()ing and PTRACE_SEIZE, because
   // any abnormal exit of the rr process will leave the child paused and
@@ -31,18 +31,25 @@ namespace rr {
 // MUST increment this version number.  Otherwise users' old traces
 // will become unreplayable and they won't know why.
 //
-#define TRACE_VERSION 52
+#define TRACE_VERSION 53
 
 struct SubstreamData {
   const char* name;
   size_t block_size;
   int threads;
+  // Bounds for the zlib level CompressedWriter picks for each block. The
+  // metadata substreams are small and compress very well, so they can
+  // afford the highest levels. Raw data can be huge and bursty, so under
+  // pressure we let it fall back to storing blocks uncompressed rather than
+  // stall the tracees.
+  int min_level;
+  int max_level;
 };
 
 static SubstreamData substreams[TraceStream::SUBSTREAM_COUNT] = {
-  { "events", 1024 * 1024, 1 }, { "data_header", 1024 * 1024, 1 },
-  { "data", 1024 * 1024, 0 },   { "mmaps", 64 * 1024, 1 },
-  { "tasks", 64 * 1024, 1 },    { "generic", 64 * 1024, 1 },
+  { "events", 1024 * 1024, 1, 1, 9 }, { "data_header", 1024 * 1024, 1, 1, 9 },
+  { "data", 1024 * 1024, 0, 0, 6 },   { "mmaps", 64 * 1024, 1, 1, 9 },
+  { "tasks", 64 * 1024, 1, 1, 9 },    { "generic", 64 * 1024, 1, 1, 9 },
 };
 
 static const SubstreamData& substream(TraceStream::Substream s) {
@@ -52,6 +59,14 @@ static const SubstreamData& substream(TraceStream::Substream s) {
   return substreams[s];
 }
 
+static_assert(sizeof(TraceStream::FrameIndexEntry) ==
+                  24 + 8 * TraceStream::SUBSTREAM_COUNT,
+              "Frame index entries must have a fixed layout");
+
+// Number of frame index entries we buffer before writing them out, or read
+// at once.
+static const size_t FRAME_INDEX_BUFFER_ENTRIES = 4096;
+
 static TraceStream::Substream operator++(TraceStream::Substream& s) {
   s = (TraceStream::Substream)(s + 1);
   return s;
@@ -154,6 +169,10 @@ string TraceStream::file_data_clone_file_name(const TaskUid& tuid) {
   return ss.str();
 }
 
+const char* TraceStream::substream_name(Substream s) {
+  return substream(s).name;
+}
+
 string TraceStream::path(Substream s) {
   return trace_dir + "/" + substream(s).name;
 }
@@ -187,6 +206,21 @@ struct BasicInfo {
 void TraceWriter::write_frame(const TraceFrame& frame) {
   auto& events = writer(EVENTS);
 
+  FrameIndexEntry index_entry;
+  index_entry.global_time = frame.time();
+  index_entry.tid = frame.tid();
+  index_entry.event = frame.event().encode();
+  index_entry.reserved = 0;
+  index_entry.ticks = frame.ticks();
+  // Records for this frame in other substreams were written before the
+  // frame itself, so they start where the previous frame's ended.
+  memcpy(index_entry.substream_offsets, frame_start_offsets,
+         sizeof(frame_start_offsets));
+  pending_index_entries.push_back(index_entry);
+  if (pending_index_entries.size() >= FRAME_INDEX_BUFFER_ENTRIES) {
+    flush_frame_index();
+  }
+
   BasicInfo basic_info = { frame.time(), frame.tid(), frame.event().encode(),
                            frame.ticks(), frame.monotonic_time() };
   events << basic_info;
@@ -223,9 +257,23 @@ void TraceWriter::write_frame(const TraceFrame& frame) {
     events << frame.event().Signal().signal_data();
   }
 
+  for (Substream s = SUBSTREAM_FIRST; s < SUBSTREAM_COUNT; ++s) {
+    frame_start_offsets[s] = writer(s).position();
+  }
   tick_time();
 }
 
+void TraceWriter::flush_frame_index() {
+  if (pending_index_entries.empty()) {
+    return;
+  }
+  ssize_t len = pending_index_entries.size() * sizeof(FrameIndexEntry);
+  if (write(frame_index_fd, pending_index_entries.data(), len) != len) {
+    FATAL() << "Unable to write " << frame_index_path();
+  }
+  pending_index_entries.clear();
+}
+
 TraceFrame TraceReader::read_frame() {
   // Read the common event info first, to see if we also have
   // exec info to read.
@@ -358,6 +406,63 @@ bool TraceWriter::try_clone_file(const string& file_name, string* new_name) {
   return true;
 }
 
+/**
+ * Private file mappings at least this big that we would otherwise record in
+ * the compressed raw-data stream are instead copied into a standalone file
+ * in the trace directory. Replay maps that file directly, so the kernel
+ * pages the data in on demand instead of rr decompressing all of it and
+ * writing it into the tracee up front. Smaller mappings aren't worth a
+ * file of their own.
+ */
+static const size_t MIN_COPIED_MAPPING_SIZE = 256 * 1024;
+static const size_t COPY_MAPPING_CHUNK_SIZE = 1024 * 1024;
+
+bool TraceWriter::try_copy_mapping(Task* t, const KernelMapping& km,
+                                   const struct stat& stat, string* new_name) {
+  if (km.inode() == 0 || stat.st_size <= 0 ||
+      (uint64_t)stat.st_size <= km.file_offset_bytes()) {
+    // Device files can have zero size; don't guess how much to copy.
+    return false;
+  }
+  size_t len =
+      min<uint64_t>(stat.st_size - km.file_offset_bytes(), km.size());
+  if (len < MIN_COPIED_MAPPING_SIZE) {
+    return false;
+  }
+
+  char count_str[20];
+  sprintf(count_str, "%d", mmap_count);
+
+  string path =
+      string("mmap_copy_") + count_str + "_" + base_file_name(km.fsname());
+  string dest_path = dir() + "/" + path;
+  ScopedFd dest(dest_path.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0600);
+  if (!dest.is_open()) {
+    return false;
+  }
+
+  // Copy what the tracee sees right after the mmap, just like the
+  // record_remote() we're replacing would. The data goes at its original
+  // file offset (leaving a hole before it) so the recorded offset is valid
+  // for the copy too, and the copy ends where the original file did, so
+  // the zero-filled tail of the last page matches.
+  vector<uint8_t> buf(min(len, COPY_MAPPING_CHUNK_SIZE));
+  for (size_t done = 0; done < len;) {
+    ssize_t chunk = min(len - done, buf.size());
+    if (t->read_bytes_fallible(km.start() + done, chunk, buf.data()) !=
+            chunk ||
+        pwrite64(dest, buf.data(), chunk, km.file_offset_bytes() + done) !=
+            chunk) {
+      unlink(dest_path.c_str());
+      return false;
+    }
+    done += chunk;
+  }
+
+  *new_name = path;
+  return true;
+}
+
 TraceWriter::RecordInTrace TraceWriter::write_mapped_region(
     Task* t, const KernelMapping& km, const struct stat& stat,
     MappingOrigin origin) {
@@ -376,7 +481,12 @@ TraceWriter::RecordInTrace TraceWriter::write_mapped_region(
   } else if (should_copy_mmap_region(km, stat) &&
              files_assumed_immutable.find(make_pair(
                  stat.st_dev, stat.st_ino)) == files_assumed_immutable.end()) {
-    source = TraceReader::SOURCE_TRACE;
+    if ((km.flags() & MAP_PRIVATE) && origin == SYSCALL_MAPPING &&
+        try_copy_mapping(t, km, stat, &backing_file_name)) {
+      source = TraceReader::SOURCE_FILE;
+    } else {
+      source = TraceReader::SOURCE_TRACE;
+    }
   } else {
     source = TraceReader::SOURCE_FILE;
     // Try hardlinking file into the trace directory. This will avoid
@@ -430,8 +540,12 @@ KernelMapping TraceReader::read_mapped_region(MappedData* data, bool* found) {
   assert(time == global_time);
   if (data->source == SOURCE_FILE) {
     static const string clone_prefix("mmap_clone_");
+    static const string copy_prefix("mmap_copy_");
+    // Clones and copies are private to the trace, so their metadata
+    // doesn't match the original file's but they can't have changed.
     bool is_clone =
-        backing_file_name.substr(0, clone_prefix.size()) == clone_prefix;
+        backing_file_name.substr(0, clone_prefix.size()) == clone_prefix ||
+        backing_file_name.substr(0, copy_prefix.size()) == copy_prefix;
     if (backing_file_name[0] != '/') {
       backing_file_name = dir() + "/" + backing_file_name;
     }
@@ -517,6 +631,63 @@ bool TraceReader::read_raw_data_for_frame(const TraceFrame& frame, RawData& d) {
   return true;
 }
 
+size_t TraceReader::read_raw_data_in_place(const RawDataConsumer& consumer) {
+  return read_raw_data_in_place(consumer, false);
+}
+
+size_t TraceReader::read_raw_data_in_place(const RawDataConsumer& consumer,
+                                           bool merge_following) {
+  auto& data = reader(RAW_DATA);
+  auto& data_header = reader(RAW_DATA_HEADER);
+  TraceFrame::Time time;
+  remote_ptr<void> addr;
+  size_t num_bytes;
+  data_header >> time >> addr >> num_bytes;
+  assert(time == global_time);
+  // Records are stored back to back in RAW_DATA, so records for
+  // consecutive tracee memory can be treated as one.
+  while (merge_following && !addr.is_null() && !data_header.at_end()) {
+    TraceFrame::Time next_time;
+    remote_ptr<void> next_addr;
+    size_t next_num_bytes;
+    data_header.save_state();
+    data_header >> next_time >> next_addr >> next_num_bytes;
+    if (next_time != time || next_addr != addr + num_bytes) {
+      data_header.restore_state();
+      break;
+    }
+    data_header.discard_state();
+    num_bytes += next_num_bytes;
+  }
+
+  remote_ptr<void> dest = addr;
+  data.read_in_place(num_bytes, [&](const uint8_t* piece, size_t len) {
+    if (!addr.is_null()) {
+      consumer(dest, piece, len);
+    }
+    dest += len;
+  });
+  return num_bytes;
+}
+
+bool TraceReader::read_raw_data_for_frame_in_place(
+    const TraceFrame& frame, const RawDataConsumer& consumer) {
+  auto& data_header = reader(RAW_DATA_HEADER);
+  if (data_header.at_end()) {
+    return false;
+  }
+  TraceFrame::Time time;
+  data_header.save_state();
+  data_header >> time;
+  data_header.restore_state();
+  assert(time >= frame.time());
+  if (time > frame.time()) {
+    return false;
+  }
+  read_raw_data_in_place(consumer, true);
+  return true;
+}
+
 void TraceWriter::write_generic(const void* d, size_t len) {
   auto& generic = writer(GENERIC);
   generic << global_time << len;
@@ -552,8 +723,16 @@ bool TraceReader::read_generic_for_frame(const TraceFrame& frame,
 }
 
 void TraceWriter::close() {
-  for (auto& w : writers) {
-    w->close();
+  flush_frame_index();
+  for (Substream s = SUBSTREAM_FIRST; s < SUBSTREAM_COUNT; ++s) {
+    writer(s).close();
+    auto st = stats(s);
+    LOG(info) << substream(s).name << ": " << st.uncompressed_bytes
+              << " bytes in, " << st.bytes_written << " bytes written; "
+              << "producer stalled " << st.producer_stall_sec << "s, "
+              << "writes stalled " << st.write_stall_sec << "s; "
+              << "max queue depth " << st.max_queue_depth << " blocks, "
+              << st.max_io_queue_bytes << " I/O bytes";
   }
 }
 
@@ -580,7 +759,8 @@ static string make_trace_dir(const string& exe_path) {
 }
 
 TraceWriter::TraceWriter(const vector<string>& argv, const vector<string>& envp,
-                         const string& cwd, int bind_to_cpu)
+                         const string& cwd, int bind_to_cpu,
+                         CompressedWriter::IoMode io_mode)
     : TraceStream(make_trace_dir(argv[0]),
                   // Somewhat arbitrarily start the
                   // global time from 1.
@@ -594,7 +774,16 @@ TraceWriter::TraceWriter(const vector<string>& argv, const vector<string>& envp,
 
   for (Substream s = SUBSTREAM_FIRST; s < SUBSTREAM_COUNT; ++s) {
     writers[s] = unique_ptr<CompressedWriter>(new CompressedWriter(
-        path(s), substream(s).block_size, substream(s).threads));
+        path(s), substream(s).block_size, substream(s).threads, io_mode,
+        substream(s).min_level, substream(s).max_level));
+  }
+
+  memset(frame_start_offsets, 0, sizeof(frame_start_offsets));
+  string index_path = frame_index_path();
+  frame_index_fd =
+      ScopedFd(index_path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0400);
+  if (!frame_index_fd.is_open()) {
+    FATAL() << "Unable to create " << index_path;
   }
 
   string ver_path = version_path();
@@ -667,6 +856,54 @@ TraceFrame TraceReader::peek_frame() {
   return frame;
 }
 
+bool TraceReader::read_frame_index(TraceFrame::Time time,
+                                   FrameIndexEntry* entry) {
+  if (!frame_index_fd->is_open() || time < 1) {
+    return false;
+  }
+  if (time < frame_index_chunk_start ||
+      time - frame_index_chunk_start >= frame_index_chunk.size()) {
+    // Global time starts at 1.
+    frame_index_chunk_start =
+        (time - 1) / FRAME_INDEX_BUFFER_ENTRIES * FRAME_INDEX_BUFFER_ENTRIES +
+        1;
+    frame_index_chunk.resize(FRAME_INDEX_BUFFER_ENTRIES);
+    ssize_t len = frame_index_chunk.size() * sizeof(FrameIndexEntry);
+    off64_t offset = off64_t(frame_index_chunk_start - 1) * sizeof(*entry);
+    ssize_t ret =
+        pread64(*frame_index_fd, frame_index_chunk.data(), len, offset);
+    frame_index_chunk.resize(ret > 0 ? ret / sizeof(FrameIndexEntry) : 0);
+    if (time - frame_index_chunk_start >= frame_index_chunk.size()) {
+      return false;
+    }
+  }
+  *entry = frame_index_chunk[time - frame_index_chunk_start];
+  return entry->global_time == time;
+}
+
+bool TraceReader::seek_to_frame(TraceFrame::Time time) {
+  FrameIndexEntry entry;
+  if (!read_frame_index(time, &entry)) {
+    return false;
+  }
+  // Check every offset before moving any reader. If rr was killed while
+  // recording, the index can point past the data that reached disk; the
+  // caller then falls back to scanning from where we are.
+  for (Substream s = SUBSTREAM_FIRST; s < SUBSTREAM_COUNT; ++s) {
+    if (entry.substream_offsets[s] > reader(s).uncompressed_bytes()) {
+      LOG(warn) << "Frame index for " << dir() << " points past the end of "
+                << substream(s).name << "; ignoring it";
+      return false;
+    }
+  }
+  for (Substream s = SUBSTREAM_FIRST; s < SUBSTREAM_COUNT; ++s) {
+    bool found = reader(s).seek(entry.substream_offsets[s]);
+    assert(found);
+  }
+  global_time = time - 1;
+  return true;
+}
+
 void TraceReader::rewind() {
   for (Substream s = SUBSTREAM_FIRST; s < SUBSTREAM_COUNT; ++s) {
     reader(s).rewind();
@@ -685,6 +922,10 @@ TraceReader::TraceReader(const string& dir)
   for (Substream s = SUBSTREAM_FIRST; s < SUBSTREAM_COUNT; ++s) {
     readers[s] = unique_ptr<CompressedReader>(new CompressedReader(path(s)));
   }
+  // Traces recorded before the frame index was added don't have one.
+  frame_index_fd = make_shared<ScopedFd>(frame_index_path().c_str(),
+                                         O_RDONLY | O_CLOEXEC);
+  frame_index_chunk_start = 0;
 
   string path = version_path();
   fstream vfile(path.c_str(), fstream::in);
@@ -739,6 +980,8 @@ TraceReader::TraceReader(const TraceReader& other)
     readers[s] =
         unique_ptr<CompressedReader>(new CompressedReader(other.reader(s)));
   }
+  frame_index_fd = other.frame_index_fd;
+  frame_index_chunk_start = 0;
 
   argv = other.argv;
   envp = other.envp;
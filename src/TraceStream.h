@@ -5,6 +5,8 @@
 
 #include <unistd.h>
 
+#include <functional>
+#include <map>
 #include <memory>
 #include <set>
 #include <string>
@@ -14,6 +16,7 @@
 #include "CompressedWriter.h"
 #include "Event.h"
 #include "remote_ptr.h"
+#include "ScopedFd.h"
 #include "TaskishUid.h"
 #include "TraceFrame.h"
 #include "TraceTaskEvent.h"
@@ -72,8 +75,35 @@ public:
    */
   TraceFrame::Time time() const { return global_time; }
 
+  /**
+   * An entry in the frame index. The index is a flat file with one of these
+   * for every frame, in order of global time, so the entry for a frame can
+   * be found without reading the events substream.
+   */
+  struct FrameIndexEntry {
+    TraceFrame::Time global_time;
+    pid_t tid;
+    EncodedEvent event;
+    uint32_t reserved;
+    Ticks ticks;
+    /* Uncompressed offset in each substream where the records for this
+     * frame start */
+    uint64_t substream_offsets[SUBSTREAM_COUNT];
+  };
+
   std::string file_data_clone_file_name(const TaskUid& tuid);
 
+  /** Return the name of the file storing substream |s|. */
+  static const char* substream_name(Substream s);
+
+  /**
+   * Return the path of the file that a recording in progress in
+   * |trace_dir| periodically rewrites with its current statistics.
+   */
+  static string live_stats_path(const string& trace_dir) {
+    return trace_dir + "/live_stats";
+  }
+
 protected:
   TraceStream(const string& trace_dir, TraceFrame::Time initial_time)
       : trace_dir(trace_dir), global_time(initial_time) {}
@@ -94,6 +124,10 @@ protected:
    * trace.
    */
   string version_path() const { return trace_dir + "/version"; }
+  /**
+   * Return the path of the frame index file.
+   */
+  string frame_index_path() const { return trace_dir + "/frame_index"; }
 
   /**
    * Increment the global time and return the incremented value.
@@ -167,6 +201,13 @@ public:
    */
   void close();
 
+  /**
+   * Return write statistics for substream |s|.
+   */
+  CompressedWriter::Stats stats(Substream s) const {
+    return writer(s).stats();
+  }
+
   /**
    * Create a trace that will record the initial exe
    * image |argv[0]| with initial args |argv|, initial environment |envp|,
@@ -176,7 +217,8 @@ public:
    */
   TraceWriter(const std::vector<std::string>& argv,
               const std::vector<std::string>& envp, const string& cwd,
-              int bind_to_cpu);
+              int bind_to_cpu, CompressedWriter::IoMode io_mode =
+                                   CompressedWriter::BLOCKING_IO);
 
   /**
    * We got far enough into recording that we should set this as the latest
@@ -185,13 +227,21 @@ public:
   void make_latest_trace();
 
 private:
+  void flush_frame_index();
   std::string try_hardlink_file(const std::string& file_name);
   bool try_clone_file(const std::string& file_name, std::string* new_name);
+  bool try_copy_mapping(Task* t, const KernelMapping& km,
+                        const struct stat& stat, std::string* new_name);
 
   CompressedWriter& writer(Substream s) { return *writers[s]; }
   const CompressedWriter& writer(Substream s) const { return *writers[s]; }
 
   std::unique_ptr<CompressedWriter> writers[SUBSTREAM_COUNT];
+  ScopedFd frame_index_fd;
+  /* Frame index entries not yet written to frame_index_fd */
+  std::vector<FrameIndexEntry> pending_index_entries;
+  /* Substream positions just after the last frame was written */
+  uint64_t frame_start_offsets[SUBSTREAM_COUNT];
   /**
    * Files that have already been mapped without being copied to the trace,
    * i.e. that we have already assumed to be immutable.
@@ -266,6 +316,29 @@ public:
    */
   bool read_raw_data_for_frame(const TraceFrame& frame, RawData& d);
 
+  /**
+   * Receives recorded tracee data without it being copied out of the trace
+   * reader's buffers: |len| bytes at |data| belong at |addr| in the tracee.
+   * |data| is only valid during the call.
+   */
+  typedef std::function<void(remote_ptr<void> addr, const uint8_t* data,
+                             size_t len)> RawDataConsumer;
+
+  /**
+   * Like read_raw_data(), but passes the data to |consumer| in one or more
+   * pieces instead of returning it. Records with a null address are
+   * consumed without calling |consumer|. Returns the size of the record.
+   */
+  size_t read_raw_data_in_place(const RawDataConsumer& consumer);
+
+  /**
+   * Like read_raw_data_for_frame(), but passes the data to |consumer|. The
+   * following records for 'frame' that continue this one in tracee memory
+   * are merged into it.
+   */
+  bool read_raw_data_for_frame_in_place(const TraceFrame& frame,
+                                        const RawDataConsumer& consumer);
+
   void read_generic(std::vector<uint8_t>& out);
   bool read_generic_for_frame(const TraceFrame& frame,
                               std::vector<uint8_t>& out);
@@ -293,8 +366,27 @@ public:
    */
   void rewind();
 
+  /**
+   * Look up |time|'s frame in the frame index. Returns false if the trace
+   * has no index or the frame isn't in it (e.g. it was recorded by a
+   * version of rr that didn't write one, or recording was cut short).
+   */
+  bool read_frame_index(TraceFrame::Time time, FrameIndexEntry* entry);
+
+  /**
+   * Use the frame index to move straight to the frame for |time|, so
+   * that the next read_frame() returns it. Returns false, leaving the
+   * position unchanged, if the frame isn't in the index.
+   * This only repositions the trace streams; it's for tools that read the
+   * trace without replaying it.
+   */
+  bool seek_to_frame(TraceFrame::Time time);
+
   uint64_t uncompressed_bytes() const;
   uint64_t compressed_bytes() const;
+  std::map<uint32_t, uint64_t> compression_levels(Substream s) const {
+    return reader(s).compression_levels();
+  }
 
   /**
    * Open the trace in 'dir'. When 'dir' is the empty string, open the
@@ -310,10 +402,18 @@ public:
   TraceReader(const TraceReader& other);
 
 private:
+  size_t read_raw_data_in_place(const RawDataConsumer& consumer,
+                                bool merge_following);
+
   CompressedReader& reader(Substream s) { return *readers[s]; }
   const CompressedReader& reader(Substream s) const { return *readers[s]; }
 
   std::unique_ptr<CompressedReader> readers[SUBSTREAM_COUNT];
+  std::shared_ptr<ScopedFd> frame_index_fd;
+  /* Index entries read by the last frame index lookup, starting with the
+   * one for frame_index_chunk_start */
+  std::vector<FrameIndexEntry> frame_index_chunk;
+  TraceFrame::Time frame_index_chunk_start;
 };
 
 } // namespace rr
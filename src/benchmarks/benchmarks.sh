@@ -0,0 +1,18 @@
+#!/bin/sh
+
+# Benchmarks measure rr's record and replay overhead on workloads that
+# stress its known hot paths: buffered and unbuffered syscalls, signals,
+# futex context switches, large reads and mappings, fork/exec and
+# reverse execution. Timings are only meaningful on an otherwise idle
+# machine with the 'performance' CPU frequency governor.
+#
+# Results are printed as JSON. To catch regressions, save the results of
+# a known-good build and pass them back in; the harness exits with status
+# 1 if anything got noticeably slower or bigger:
+#
+#   benchmarks.sh <objdir> -o good.json
+#   benchmarks.sh <objdir> --baseline good.json
+#
+# Usage: benchmarks.sh <path-to-rr-objdir> [harness options] [benchmark...]
+
+python `dirname $0`/harness.py "$@"
@@ -0,0 +1,23 @@
+/* -*- Mode: C; tab-width: 8; c-basic-offset: 2; indent-tabs-mode: nil; -*- */
+
+#ifndef RR_BENCHUTIL_H
+#define RR_BENCHUTIL_H
+
+#include "../test/rrutil.h"
+
+/**
+ * Return argv[index] as a positive integer, or |def| if it wasn't given.
+ * Benchmarks take their iteration counts this way so the harness can
+ * scale them.
+ */
+inline static long int_arg(int argc, char** argv, int index, long def) {
+  long v;
+  if (index >= argc) {
+    return def;
+  }
+  v = atol(argv[index]);
+  test_assert(v > 0);
+  return v;
+}
+
+#endif
@@ -0,0 +1,45 @@
+/* -*- Mode: C; tab-width: 8; c-basic-offset: 2; indent-tabs-mode: nil; -*- */
+
+#include "benchutil.h"
+
+/* Usage: fork_exec_tree [<depth> [<fanout>]]
+
+   Builds a process tree <depth> levels deep where every interior node
+   forks <fanout> children, each of which execs this program again one
+   level down, and waits for them. */
+
+int main(int argc, char** argv) {
+  long depth = int_arg(argc, argv, 1, 4);
+  long fanout = int_arg(argc, argv, 2, 4);
+  char depth_str[32];
+  char fanout_str[32];
+  long i;
+
+  /* Children get an extra argument so only the root reports success. */
+  int is_root = argc < 4;
+
+  if (depth <= 1) {
+    return 0;
+  }
+  sprintf(depth_str, "%ld", depth - 1);
+  sprintf(fanout_str, "%ld", fanout);
+  for (i = 0; i < fanout; ++i) {
+    pid_t child = fork();
+    test_assert(child >= 0);
+    if (!child) {
+      char* child_argv[] = { argv[0], depth_str, fanout_str, "child", NULL };
+      execv("/proc/self/exe", child_argv);
+      test_assert(0 && "exec failed");
+    }
+  }
+  for (i = 0; i < fanout; ++i) {
+    int status;
+    test_assert(wait(&status) > 0);
+    test_assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  }
+
+  if (is_root) {
+    atomic_puts("EXIT-SUCCESS");
+  }
+  return 0;
+}
@@ -0,0 +1,48 @@
+/* -*- Mode: C; tab-width: 8; c-basic-offset: 2; indent-tabs-mode: nil; -*- */
+
+#include "benchutil.h"
+
+/* Usage: futex_pingpong [<round-trips>]
+
+   Two threads take turns flipping a shared word and waking each other
+   with FUTEX_WAKE, so every turn forces a context switch. */
+
+static int turn;
+static long round_trips;
+
+static void wait_for_turn(int me) {
+  int cur;
+  while ((cur = __atomic_load_n(&turn, __ATOMIC_ACQUIRE)) != me) {
+    syscall(SYS_futex, &turn, FUTEX_WAIT_PRIVATE, cur, NULL, NULL, 0);
+  }
+}
+
+static void pass_turn(int other) {
+  __atomic_store_n(&turn, other, __ATOMIC_RELEASE);
+  syscall(SYS_futex, &turn, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+static void* pong(__attribute__((unused)) void* arg) {
+  long i;
+  for (i = 0; i < round_trips; ++i) {
+    wait_for_turn(1);
+    pass_turn(0);
+  }
+  return NULL;
+}
+
+int main(int argc, char** argv) {
+  pthread_t thread;
+  long i;
+
+  round_trips = int_arg(argc, argv, 1, 20000);
+  test_assert(0 == pthread_create(&thread, NULL, pong, NULL));
+  for (i = 0; i < round_trips; ++i) {
+    pass_turn(1);
+    wait_for_turn(0);
+  }
+  test_assert(0 == pthread_join(thread, NULL));
+
+  atomic_puts("EXIT-SUCCESS");
+  return 0;
+}
@@ -0,0 +1,208 @@
+from __future__ import print_function
+
+import argparse
+import json
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+# Each benchmark runs |program| with |args| natively, under rr record (with
+# |record_args|) and under rr replay -a. Benchmarks with a |gdb_script|
+# are also replayed under gdb running that script.
+BENCHMARKS = [
+    { 'name': 'syscall_buffered',
+      'program': 'syscall_loop', 'args': ['buffered', '200000'] },
+    { 'name': 'syscall_buffered_no_syscallbuf',
+      'program': 'syscall_loop', 'args': ['buffered', '50000'],
+      'record_args': ['-n'] },
+    { 'name': 'syscall_unbuffered',
+      'program': 'syscall_loop', 'args': ['unbuffered', '50000'] },
+    { 'name': 'signal_storm',
+      'program': 'signal_storm', 'args': ['20000'] },
+    { 'name': 'futex_pingpong',
+      'program': 'futex_pingpong', 'args': ['20000'] },
+    { 'name': 'large_read',
+      'program': 'large_data', 'args': ['read', '256'] },
+    { 'name': 'large_mmap',
+      'program': 'large_data', 'args': ['mmap', '256'] },
+    { 'name': 'fork_exec_tree',
+      'program': 'fork_exec_tree', 'args': ['4', '4'] },
+    { 'name': 'reverse_continue',
+      'program': 'reverse_continue_loop', 'args': ['100000'],
+      'gdb_script': ['set confirm off',
+                     'break checkpoint_here',
+                     'continue',
+                     'continue',
+                     'reverse-continue',
+                     'kill',
+                     'quit'] },
+]
+
+# Trace files that hold one substream each. Copied, cloned or hardlinked
+# mapped files are counted as 'mapped_files', and anything else (the
+# version file, the frame index, ...) as 'other'.
+SUBSTREAMS = ['events', 'data_header', 'data', 'mmaps', 'tasks', 'generic']
+
+# Measurements compared against the baseline, and whether they're noisy
+# (timings) or should be reproducible (everything else).
+COMPARED = [('record_sec', True), ('replay_sec', True),
+            ('reverse_continue_sec', True), ('trace_bytes_total', False),
+            ('record_ptrace_stops', False), ('replay_ptrace_stops', False)]
+
+class BenchmarkFailed(Exception):
+    pass
+
+def timed_run(cmd, cwd, env=None, stdin=None):
+    with open(os.devnull, 'w') as null:
+        start = time.time()
+        p = subprocess.Popen(cmd, cwd=cwd, env=env, stdin=stdin,
+                             stdout=null, stderr=null)
+        ret = p.wait()
+        elapsed = time.time() - start
+    if ret != 0:
+        raise BenchmarkFailed('%s exited with status %d' % (' '.join(cmd), ret))
+    return elapsed
+
+def read_stats(path):
+    with open(path) as f:
+        return json.load(f)
+
+def trace_sizes(trace_dir):
+    sizes = dict((s, 0) for s in SUBSTREAMS)
+    sizes['mapped_files'] = 0
+    sizes['other'] = 0
+    for f in os.listdir(trace_dir):
+        size = os.path.getsize(os.path.join(trace_dir, f))
+        if f in SUBSTREAMS:
+            sizes[f] += size
+        elif f.startswith('mmap_'):
+            sizes['mapped_files'] += size
+        else:
+            sizes['other'] += size
+    return sizes
+
+def median(values):
+    values = sorted(values)
+    n = len(values)
+    if n % 2:
+        return values[n // 2]
+    return (values[n // 2 - 1] + values[n // 2]) / 2.0
+
+def run_once(objdir, bench):
+    rr = os.path.join(objdir, 'bin', 'rr')
+    program = [os.path.join(objdir, 'bin', bench['program'])] + bench['args']
+    d = tempfile.mkdtemp(prefix='rr-bench-')
+    try:
+        env = dict(os.environ)
+        env['_RR_TRACE_DIR'] = d
+        result = {}
+        result['native_sec'] = timed_run(program, d)
+
+        record_stats = os.path.join(d, 'record-stats')
+        result['record_sec'] = timed_run(
+            [rr, '--statistics-file=' + record_stats, 'record'] +
+            bench.get('record_args', []) + program, d, env)
+        trace_dir = os.path.join(d, bench['program'] + '-0')
+
+        replay_stats = os.path.join(d, 'replay-stats')
+        result['replay_sec'] = timed_run(
+            [rr, '--statistics-file=' + replay_stats, 'replay', '-a',
+             trace_dir], d, env)
+
+        if 'gdb_script' in bench:
+            script = os.path.join(d, 'gdb-script')
+            with open(script, 'w') as f:
+                f.write('\n'.join(bench['gdb_script']) + '\n')
+            with open(os.devnull) as null:
+                result['reverse_continue_sec'] = timed_run(
+                    [rr, 'replay', '-x', script, trace_dir], d, env, null)
+
+        result['record_ptrace_stops'] = read_stats(record_stats)['ptrace_stops']
+        result['replay_ptrace_stops'] = read_stats(replay_stats)['ptrace_stops']
+        result['trace_bytes'] = trace_sizes(trace_dir)
+        result['trace_bytes_total'] = sum(result['trace_bytes'].values())
+        return result
+    finally:
+        shutil.rmtree(d)
+
+def run_benchmark(objdir, bench, runs):
+    results = [run_once(objdir, bench) for i in range(runs)]
+    # Timings are the median over all runs; the other measurements should
+    # be the same for every run, so just report the last one.
+    summary = dict(results[-1])
+    for key in ['native_sec', 'record_sec', 'replay_sec',
+                'reverse_continue_sec']:
+        if key in summary:
+            summary[key] = median([r[key] for r in results])
+    summary['record_overhead'] = summary['record_sec'] / summary['native_sec']
+    summary['replay_overhead'] = summary['replay_sec'] / summary['native_sec']
+    return summary
+
+def find_regressions(results, baseline, time_threshold, count_threshold):
+    regressions = []
+    for name, current in sorted(results.items()):
+        old = baseline.get(name)
+        if not old:
+            continue
+        for key, noisy in COMPARED:
+            if key not in current or key not in old:
+                continue
+            threshold = time_threshold if noisy else count_threshold
+            if current[key] > old[key] * (1 + threshold):
+                regressions.append('%s: %s went from %s to %s' %
+                                   (name, key, old[key], current[key]))
+    return regressions
+
+parser = argparse.ArgumentParser(
+    description='Measure rr record and replay overhead on a set of '
+                'workloads and report the results as JSON.')
+parser.add_argument('objdir', help='rr build directory')
+parser.add_argument('benchmarks', nargs='*',
+                    help='benchmarks to run (default: all)')
+parser.add_argument('--runs', type=int, default=3,
+                    help='number of times to run each benchmark')
+parser.add_argument('-o', '--output', help='write results to this file')
+parser.add_argument('--baseline',
+                    help='results file from an earlier run to compare with')
+parser.add_argument('--time-threshold', type=float, default=0.1,
+                    help='fractional slowdown that counts as a regression')
+parser.add_argument('--count-threshold', type=float, default=0.02,
+                    help='fractional growth in trace size or ptrace stops '
+                         'that counts as a regression')
+args = parser.parse_args()
+
+names = [b['name'] for b in BENCHMARKS]
+for name in args.benchmarks:
+    if name not in names:
+        sys.exit('Unknown benchmark %s; choose from %s' %
+                 (name, ' '.join(names)))
+
+results = {}
+for bench in BENCHMARKS:
+    if args.benchmarks and bench['name'] not in args.benchmarks:
+        continue
+    print('Running %s ...' % bench['name'], file=sys.stderr)
+    try:
+        results[bench['name']] = run_benchmark(args.objdir, bench, args.runs)
+    except BenchmarkFailed as e:
+        sys.exit('Benchmark %s failed: %s' % (bench['name'], e))
+
+output = json.dumps({ 'runs': args.runs, 'benchmarks': results },
+                    indent=2, sort_keys=True)
+if args.output:
+    with open(args.output, 'w') as f:
+        f.write(output + '\n')
+else:
+    print(output)
+
+if args.baseline:
+    baseline = read_stats(args.baseline)['benchmarks']
+    regressions = find_regressions(results, baseline, args.time_threshold,
+                                   args.count_threshold)
+    for r in regressions:
+        print('REGRESSION: ' + r, file=sys.stderr)
+    if regressions:
+        sys.exit(1)
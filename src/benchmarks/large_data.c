@@ -0,0 +1,54 @@
+/* -*- Mode: C; tab-width: 8; c-basic-offset: 2; indent-tabs-mode: nil; -*- */
+
+#include "benchutil.h"
+
+/* Usage: large_data read|mmap [<megabytes>]
+
+   Writes a <megabytes> file in the current directory, then either read()s
+   it back in 1MB chunks (so the data lands in the trace) or maps it
+   MAP_PRIVATE and touches every page (so rr has to copy or clone it). */
+
+#define CHUNK_SIZE (1024 * 1024)
+
+int main(int argc, char** argv) {
+  long megabytes = int_arg(argc, argv, 2, 256);
+  size_t size = (size_t)megabytes * CHUNK_SIZE;
+  char name[] = "large_data-XXXXXX";
+  char* buf = malloc(CHUNK_SIZE);
+  uint64_t sum = 0;
+  long i;
+  int fd;
+
+  test_assert(argc >= 2);
+  test_assert(buf != NULL);
+  fd = mkstemp(name);
+  test_assert(fd >= 0);
+  test_assert(0 == unlink(name));
+  for (i = 0; i < megabytes; ++i) {
+    memset(buf, (int)i, CHUNK_SIZE);
+    test_assert(CHUNK_SIZE == write(fd, buf, CHUNK_SIZE));
+  }
+
+  if (!strcmp(argv[1], "read")) {
+    test_assert(0 == lseek(fd, 0, SEEK_SET));
+    for (i = 0; i < megabytes; ++i) {
+      test_assert(CHUNK_SIZE == read(fd, buf, CHUNK_SIZE));
+      sum += (unsigned char)buf[0];
+    }
+  } else if (!strcmp(argv[1], "mmap")) {
+    size_t offset;
+    long page_size = sysconf(_SC_PAGESIZE);
+    char* p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    test_assert(p != MAP_FAILED);
+    for (offset = 0; offset < size; offset += page_size) {
+      sum += (unsigned char)p[offset];
+    }
+    test_assert(0 == munmap(p, size));
+  } else {
+    test_assert(0 && "Unknown mode");
+  }
+
+  atomic_printf("checksum %llu\n", (unsigned long long)sum);
+  atomic_puts("EXIT-SUCCESS");
+  return 0;
+}
@@ -0,0 +1,43 @@
+/* -*- Mode: C; tab-width: 8; c-basic-offset: 2; indent-tabs-mode: nil; -*- */
+
+#include "benchutil.h"
+
+/* Usage: reverse_continue_loop [<iterations>]
+
+   Calls checkpoint_here() before and after a long stretch of mixed
+   computation and syscalls. The harness replays this under gdb, stops at
+   the second call and reverse-continues to the first, so rr has to
+   search backwards across the whole interval. */
+
+static int null_fd;
+
+static void __attribute__((noinline)) checkpoint_here(long i) {
+  write(null_fd, &i, sizeof(i));
+}
+
+int main(int argc, char** argv) {
+  long iterations = int_arg(argc, argv, 1, 100000);
+  uint64_t state = 1;
+  long i;
+  int j;
+
+  null_fd = open("/dev/null", O_WRONLY);
+  test_assert(null_fd >= 0);
+
+  checkpoint_here(0);
+  for (i = 0; i < iterations; ++i) {
+    for (j = 0; j < 100; ++j) {
+      state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+    }
+    if (i % 16 == 0) {
+      syscall(SYS_getppid);
+    } else {
+      test_assert(sizeof(state) == write(null_fd, &state, sizeof(state)));
+    }
+  }
+  checkpoint_here(iterations);
+
+  atomic_printf("state %llu\n", (unsigned long long)state);
+  atomic_puts("EXIT-SUCCESS");
+  return 0;
+}
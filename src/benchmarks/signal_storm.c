@@ -0,0 +1,37 @@
+/* -*- Mode: C; tab-width: 8; c-basic-offset: 2; indent-tabs-mode: nil; -*- */
+
+#include "benchutil.h"
+
+/* Usage: signal_storm [<signals>]
+
+   Sends itself <signals> SIGUSR1s, alternating between a thread-directed
+   and a process-directed signal, and handles each one. */
+
+static volatile long caught;
+
+static void handler(__attribute__((unused)) int sig) { ++caught; }
+
+int main(int argc, char** argv) {
+  long signals = int_arg(argc, argv, 1, 20000);
+  pid_t pid = getpid();
+  pid_t tid = syscall(SYS_gettid);
+  struct sigaction sa;
+  long i;
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = handler;
+  sigemptyset(&sa.sa_mask);
+  test_assert(0 == sigaction(SIGUSR1, &sa, NULL));
+
+  for (i = 0; i < signals; ++i) {
+    if (i & 1) {
+      test_assert(0 == kill(pid, SIGUSR1));
+    } else {
+      test_assert(0 == syscall(SYS_tgkill, pid, tid, SIGUSR1));
+    }
+  }
+  test_assert(caught == signals);
+
+  atomic_puts("EXIT-SUCCESS");
+  return 0;
+}
@@ -0,0 +1,38 @@
+/* -*- Mode: C; tab-width: 8; c-basic-offset: 2; indent-tabs-mode: nil; -*- */
+
+#include "benchutil.h"
+
+/* Usage: syscall_loop buffered|unbuffered [<iterations>]
+
+   "buffered" performs cheap syscalls that the syscallbuf handles without
+   a ptrace stop (reads from /dev/zero, writes to /dev/null, getpid).
+   "unbuffered" performs syscalls that the syscallbuf never handles, so
+   every one of them costs a round trip through rr. */
+
+int main(int argc, char** argv) {
+  long iterations = int_arg(argc, argv, 2, 200000);
+  long i;
+  char buf[64];
+
+  test_assert(argc >= 2);
+  if (!strcmp(argv[1], "buffered")) {
+    int zero_fd = open("/dev/zero", O_RDONLY);
+    int null_fd = open("/dev/null", O_WRONLY);
+    test_assert(zero_fd >= 0 && null_fd >= 0);
+    for (i = 0; i < iterations; ++i) {
+      test_assert(sizeof(buf) == read(zero_fd, buf, sizeof(buf)));
+      test_assert(sizeof(buf) == write(null_fd, buf, sizeof(buf)));
+      getpid();
+    }
+  } else if (!strcmp(argv[1], "unbuffered")) {
+    pid_t parent = getppid();
+    for (i = 0; i < iterations; ++i) {
+      test_assert(parent == syscall(SYS_getppid));
+    }
+  } else {
+    test_assert(0 && "Unknown mode");
+  }
+
+  atomic_puts("EXIT-SUCCESS");
+  return 0;
+}
@@ -57,6 +57,54 @@ def write_rr_page(f, is_64, is_replay):
     ff_bytes = bytearray([0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff])
     f.write(ff_bytes)
 
+    # Batched syscall loop; see RR_PAGE_SYSCALL_BATCH_TRAP. On entry the
+    # stack holds the address of a table of (syscallno, 6 args, result) words
+    # and the number of entries. Each syscall goes through the privileged
+    # untraced stub above (offset 15) so it doesn't cause a ptrace stop.
+    if is_64:
+        batch_bytes = bytearray([
+            0xcc, # int3
+            0x48, 0x8b, 0x44, 0x24, 0x08, # mov 0x8(%rsp),%rax
+            0x48, 0x85, 0xc0, # test %rax,%rax
+            0x74, 0xf5, # je <int3>
+            0x4c, 0x8b, 0x1c, 0x24, # mov (%rsp),%r11
+            0x49, 0x8b, 0x7b, 0x08, # mov 0x8(%r11),%rdi
+            0x49, 0x8b, 0x73, 0x10, # mov 0x10(%r11),%rsi
+            0x49, 0x8b, 0x53, 0x18, # mov 0x18(%r11),%rdx
+            0x4d, 0x8b, 0x53, 0x20, # mov 0x20(%r11),%r10
+            0x4d, 0x8b, 0x43, 0x28, # mov 0x28(%r11),%r8
+            0x4d, 0x8b, 0x4b, 0x30, # mov 0x30(%r11),%r9
+            0x49, 0x8b, 0x03, # mov (%r11),%rax
+            0xe8, 0xc0, 0xff, 0xff, 0xff, # call <privileged untraced>
+            0x4c, 0x8b, 0x1c, 0x24, # mov (%rsp),%r11
+            0x49, 0x89, 0x43, 0x38, # mov %rax,0x38(%r11)
+            0x48, 0x83, 0x04, 0x24, 0x40, # addq $0x40,(%rsp)
+            0x48, 0xff, 0x4c, 0x24, 0x08, # decq 0x8(%rsp)
+            0xeb, 0xbe, # jmp <int3 + 1>
+        ])
+    else:
+        batch_bytes = bytearray([
+            0xcc, # int3
+            0x8b, 0x44, 0x24, 0x04, # mov 0x4(%esp),%eax
+            0x85, 0xc0, # test %eax,%eax
+            0x74, 0xf7, # je <int3>
+            0x8b, 0x2c, 0x24, # mov (%esp),%ebp
+            0x8b, 0x5d, 0x04, # mov 0x4(%ebp),%ebx
+            0x8b, 0x4d, 0x08, # mov 0x8(%ebp),%ecx
+            0x8b, 0x55, 0x0c, # mov 0xc(%ebp),%edx
+            0x8b, 0x75, 0x10, # mov 0x10(%ebp),%esi
+            0x8b, 0x7d, 0x14, # mov 0x14(%ebp),%edi
+            0x8b, 0x45, 0x00, # mov 0x0(%ebp),%eax
+            0x8b, 0x6d, 0x18, # mov 0x18(%ebp),%ebp
+            0xe8, 0xc9, 0xff, 0xff, 0xff, # call <privileged untraced>
+            0x8b, 0x2c, 0x24, # mov (%esp),%ebp
+            0x89, 0x45, 0x1c, # mov %eax,0x1c(%ebp)
+            0x83, 0x04, 0x24, 0x20, # addl $0x20,(%esp)
+            0xff, 0x4c, 0x24, 0x04, # decl 0x4(%esp)
+            0xeb, 0xcb, # jmp <int3 + 1>
+        ])
+    f.write(batch_bytes)
+
 generators_for = {
     'rr_page_32': lambda stream: write_rr_page(stream, False, False),
     'rr_page_64': lambda stream: write_rr_page(stream, True, False),
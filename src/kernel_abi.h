@@ -166,6 +166,7 @@ struct WordSize32Defs : public KernelConstants {
 
   static const size_t elfclass = ELFCLASS32;
   typedef Elf32_Ehdr ElfEhdr;
+  typedef Elf32_Phdr ElfPhdr;
   typedef Elf32_Shdr ElfShdr;
   typedef Elf32_Sym ElfSym;
 };
@@ -198,6 +199,7 @@ struct WordSize64Defs : public KernelConstants {
 
   static const size_t elfclass = ELFCLASS64;
   typedef Elf64_Ehdr ElfEhdr;
+  typedef Elf64_Phdr ElfPhdr;
   typedef Elf64_Shdr ElfShdr;
   typedef Elf64_Sym ElfSym;
 };
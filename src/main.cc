@@ -14,6 +14,7 @@
 #include "Flags.h"
 #include "log.h"
 #include "RecordCommand.h"
+#include "util.h"
 
 using namespace std;
 
@@ -111,6 +112,11 @@ void print_usage(FILE* out) {
       "                             'Ivy Bridge'. Note that rr will not work "
       "with\n"
       "                             Intel Merom or Penryn microarchitectures.\n"
+      "  --calibrate-skid           measure how far ticks interrupts\n"
+      "                             overshoot on this CPU and program them\n"
+      "                             closer to their targets during replay.\n"
+      "                             Faster, but replay may diverge if tracee\n"
+      "                             code skids further than rr's own code\n"
       "  -C, --checksum={on-syscalls,on-all-events}|FROM_TIME\n"
       "                             compute and store (during recording) or\n"
       "                             read and verify (during replay) checksums\n"
@@ -144,6 +150,9 @@ void print_usage(FILE* out) {
       "  -S, --suppress-environment-warnings\n"
       "                             suppress warnings about issues in the\n"
       "                             environment that rr has no control over\n"
+      "  --statistics-file=<FILE>   when recording or replaying with -a,\n"
+      "                             write statistics such as the number of\n"
+      "                             ptrace stops to FILE as JSON on exit\n"
       "  -T, --dump-at=TIME         dump memory at global timepoint TIME\n"
       "  -V, --verbose              log messages that may not be urgently \n"
       "                             critical to the user\n"
@@ -174,7 +183,9 @@ bool parse_global_option(std::vector<std::string>& args) {
     { 'S', "suppress-environment-warnings", NO_PARAMETER },
     { 'E', "fatal-errors", NO_PARAMETER },
     { 'V', "verbose", NO_PARAMETER },
-    { 'N', "version", NO_PARAMETER }
+    { 'N', "version", NO_PARAMETER },
+    { 0, "statistics-file", HAS_PARAMETER },
+    { 1, "calibrate-skid", NO_PARAMETER }
   };
 
   ParsedOption opt;
@@ -227,6 +238,12 @@ bool parse_global_option(std::vector<std::string>& args) {
     case 'N':
       show_version = true;
       break;
+    case 0:
+      flags.statistics_file = opt.value;
+      break;
+    case 1:
+      flags.calibrate_skid = true;
+      break;
     default:
       assert(0 && "Invalid flag");
   }
@@ -239,6 +256,7 @@ using namespace rr;
 
 int main(int argc, char* argv[]) {
   init_random();
+  raise_fd_limit();
 
   vector<string> args;
   for (int i = 1; i < argc; ++i) {
@@ -58,6 +58,12 @@
 #define RR_PAGE_SYSCALL_PRIVILEGED_UNTRACED_RECORDING_ONLY                     \
   RR_PAGE_SYSCALL_ADDR(7)
 #define RR_PAGE_FF_BYTES (RR_PAGE_ADDR + RR_PAGE_SYSCALL_STUB_SIZE * 8)
+/* rr's batched remote syscall loop. It runs the syscalls described by the
+ * table whose address and length are at the top of the stack, calling
+ * RR_PAGE_SYSCALL_PRIVILEGED_UNTRACED for each one, then jumps back to the
+ * int3 at RR_PAGE_SYSCALL_BATCH_TRAP. */
+#define RR_PAGE_SYSCALL_BATCH_TRAP (RR_PAGE_FF_BYTES + 8)
+#define RR_PAGE_SYSCALL_BATCH_ENTRY (RR_PAGE_SYSCALL_BATCH_TRAP + 1)
 
 /* "Magic" (rr-implemented) syscalls that we use to initialize the
  * syscallbuf.
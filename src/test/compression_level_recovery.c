@@ -0,0 +1,35 @@
+/* -*- Mode: C; tab-width: 8; c-basic-offset: 2; indent-tabs-mode: nil; -*- */
+
+#include "rrutil.h"
+
+#define CHUNK_SIZE (1 << 20)
+#define RANDOM_CHUNKS 32
+#define ZERO_CHUNKS 64
+
+static void read_chunks(const char* path, char* buf, int chunks) {
+  int fd = open(path, O_RDONLY);
+  int i;
+  test_assert(fd >= 0);
+  for (i = 0; i < chunks; ++i) {
+    ssize_t done = 0;
+    while (done < CHUNK_SIZE) {
+      ssize_t ret = read(fd, buf + done, CHUNK_SIZE - done);
+      test_assert(ret > 0);
+      done += ret;
+    }
+  }
+  close(fd);
+}
+
+int main(void) {
+  char* buf = malloc(CHUNK_SIZE);
+
+  /* A burst of incompressible data, to make the trace writer stall and
+     drop its compression level, followed by lots of compressible data
+     that it should compress properly again. */
+  read_chunks("/dev/urandom", buf, RANDOM_CHUNKS);
+  read_chunks("/dev/zero", buf, ZERO_CHUNKS);
+
+  atomic_puts("EXIT-SUCCESS");
+  return 0;
+}
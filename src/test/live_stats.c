@@ -0,0 +1,11 @@
+/* -*- Mode: C; tab-width: 8; c-basic-offset: 2; indent-tabs-mode: nil; -*- */
+
+#include "rrutil.h"
+
+int main(void) {
+  atomic_puts("sleeping");
+  /* One long blocking syscall, during which rr has nothing to record. */
+  sleep(8);
+  atomic_puts("EXIT-SUCCESS");
+  return 0;
+}
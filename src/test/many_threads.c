@@ -0,0 +1,37 @@
+/* -*- Mode: C; tab-width: 8; c-basic-offset: 2; indent-tabs-mode: nil; -*- */
+
+#include "rrutil.h"
+
+/* More threads than the default RLIMIT_NOFILE soft limit, all blocked at
+   the same time, so rr has to hold more than 1024 counter fds. */
+#define NUM_THREADS 1100
+
+static int pipe_fds[2];
+
+static void* start_thread(__attribute__((unused)) void* p) {
+  char ch;
+  test_assert(1 == read(pipe_fds[0], &ch, 1));
+  return NULL;
+}
+
+int main(void) {
+  static pthread_t threads[NUM_THREADS];
+  static char buf[NUM_THREADS];
+  pthread_attr_t attr;
+  int i;
+
+  test_assert(0 == pipe(pipe_fds));
+  pthread_attr_init(&attr);
+  pthread_attr_setstacksize(&attr, 64 * 1024);
+  for (i = 0; i < NUM_THREADS; ++i) {
+    test_assert(0 == pthread_create(&threads[i], &attr, start_thread, NULL));
+  }
+
+  test_assert(NUM_THREADS == write(pipe_fds[1], buf, NUM_THREADS));
+  for (i = 0; i < NUM_THREADS; ++i) {
+    pthread_join(threads[i], NULL);
+  }
+
+  atomic_puts("EXIT-SUCCESS");
+  return 0;
+}
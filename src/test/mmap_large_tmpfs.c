@@ -0,0 +1,47 @@
+/* -*- Mode: C; tab-width: 8; c-basic-offset: 2; indent-tabs-mode: nil; -*- */
+
+#include "rrutil.h"
+
+#define TEST_FILENAME "large_tmpfs_file"
+/* Big enough that rr stores the mapping outside the raw-data stream, and
+   not a multiple of the page size so the last page is partially zero. */
+#define FILE_SIZE (2 * 1024 * 1024 + 123)
+
+int main(void) {
+  size_t page_size = sysconf(_SC_PAGESIZE);
+  /* Extends past EOF; we only touch the partial page before it. */
+  size_t map_size = FILE_SIZE;
+  int fd = open(TEST_FILENAME, O_CREAT | O_EXCL | O_RDWR, 0600);
+  unsigned char* buf = malloc(FILE_SIZE);
+  unsigned char* bytes;
+  size_t i;
+
+  test_assert(fd >= 0);
+  for (i = 0; i < FILE_SIZE; ++i) {
+    buf[i] = (unsigned char)(i * 7 + (i >> 12));
+  }
+  test_assert(FILE_SIZE == write(fd, buf, FILE_SIZE));
+
+  /* Skip the first page so the copy has to honour the file offset. */
+  bytes = (unsigned char*)mmap(NULL, map_size, PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE, fd, page_size);
+  test_assert(bytes != MAP_FAILED);
+  close(fd);
+  unlink(TEST_FILENAME);
+
+  for (i = 0; i < FILE_SIZE - page_size; ++i) {
+    test_assert(bytes[i] == buf[i + page_size]);
+  }
+  for (; i < ((FILE_SIZE - page_size + page_size - 1) & ~(page_size - 1));
+       ++i) {
+    test_assert(bytes[i] == 0);
+  }
+  bytes[0] ^= 0xff;
+  test_assert(bytes[0] == (unsigned char)~buf[page_size]);
+
+  munmap(bytes, map_size);
+  free(buf);
+
+  atomic_puts("EXIT-SUCCESS");
+  return 0;
+}
@@ -0,0 +1,28 @@
+/* -*- Mode: C; tab-width: 8; c-basic-offset: 2; indent-tabs-mode: nil; -*- */
+
+#include "rrutil.h"
+
+/* Built with -fomit-frame-pointer, so the frame-pointer chain can't be
+   used to tell the recursion levels apart. */
+
+static void breakpoint(void) {
+  int break_here = 1;
+  (void)break_here;
+}
+
+static int recurse(int n) {
+  int ret;
+  if (n == 0) {
+    breakpoint();
+    return 0;
+  }
+  ret = recurse(n - 1) + 1;
+  atomic_printf("depth %d\n", ret);
+  return ret;
+}
+
+int main(void) {
+  test_assert(recurse(4) == 4);
+  atomic_puts("EXIT-SUCCESS");
+  return 0;
+}
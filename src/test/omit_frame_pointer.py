@@ -0,0 +1,30 @@
+from rrutil import *
+
+send_gdb('break breakpoint')
+expect_gdb('Breakpoint 1')
+send_gdb('c')
+expect_gdb('Breakpoint 1, breakpoint')
+
+send_gdb('bt')
+expect_gdb(r'#0[^b]+breakpoint[^#]+#1[^r]+recurse \(n=0\)[^#]+'
+           r'#2[^r]+recurse \(n=1\)[^#]+#3[^r]+recurse \(n=2\)[^#]+'
+           r'#4[^r]+recurse \(n=3\)[^#]+#5[^r]+recurse \(n=4\)[^#]+#6[^m]+main')
+
+send_gdb('finish')
+expect_gdb(r'recurse \(n=0\)')
+send_gdb('finish')
+expect_gdb(r'Value returned is \$1 = 0')
+
+# Back to the call of recurse(1) in recurse(2), then step further back.
+# We must stay in recurse(2).
+send_gdb('reverse-finish')
+expect_gdb(r'recurse \(n=2\)')
+send_gdb('reverse-step')
+send_gdb('p n')
+expect_gdb(r'= 2')
+
+send_gdb('bt')
+expect_gdb(r'#0[^r]+recurse \(n=2\)[^#]+#1[^r]+recurse \(n=3\)[^#]+'
+           r'#2[^r]+recurse \(n=4\)[^#]+#3[^m]+main')
+
+ok()
@@ -0,0 +1,26 @@
+from rrutil import *
+import re
+
+NUM_THREADS = 10
+
+send_gdb('b hit_barrier')
+expect_gdb('Breakpoint 1')
+
+send_gdb('c')
+expect_gdb('Breakpoint 1, hit_barrier')
+
+send_gdb('maint packet qXfer:rr-thread-regs:read:40:0,fffff')
+expect_gdb(re.compile(r'received: "l<rr-thread-regs>(.*)</rr-thread-regs>"'))
+threads = re.findall(r"<thread id='p[0-9a-f]+\.[0-9a-f]+' regs='[0-9a-fx]+' sp='[0-9a-f]+' stack='([0-9a-f]*)'/>",
+                     last_match().group(1))
+if len(threads) != NUM_THREADS + 1:
+    failed('ERROR: expected %d threads, got %d' % (NUM_THREADS + 1, len(threads)))
+for stack in threads:
+    if len(stack) != 2*0x40:
+        failed('ERROR: expected 0x40 stack bytes, got "%s"' % stack)
+
+# Absurd stack sizes are refused rather than attempted.
+send_gdb('maint packet qXfer:rr-thread-regs:read:ffffffffffff:0,fff')
+expect_gdb('received: "E01"')
+
+ok()
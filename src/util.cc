@@ -16,6 +16,7 @@
 #include <linux/prctl.h>
 #include <string.h>
 #include <stdlib.h>
+#include <sys/resource.h>
 #include <sys/vfs.h>
 #include <unistd.h>
 
@@ -721,4 +722,29 @@ double monotonic_now_sec() {
 
 bool running_under_rr() { return getenv("RUNNING_UNDER_RR") != NULL; }
 
+static struct rlimit initial_fd_limit;
+static bool fd_limit_raised;
+
+void raise_fd_limit() {
+  if (getrlimit(RLIMIT_NOFILE, &initial_fd_limit) < 0) {
+    return;
+  }
+  if (initial_fd_limit.rlim_cur == initial_fd_limit.rlim_max) {
+    return;
+  }
+  struct rlimit new_limit = initial_fd_limit;
+  new_limit.rlim_cur = new_limit.rlim_max;
+  if (setrlimit(RLIMIT_NOFILE, &new_limit) < 0) {
+    LOG(debug) << "Failed to raise RLIMIT_NOFILE: " << errno_name(errno);
+    return;
+  }
+  fd_limit_raised = true;
+}
+
+void restore_initial_fd_limit() {
+  if (fd_limit_raised) {
+    setrlimit(RLIMIT_NOFILE, &initial_fd_limit);
+  }
+}
+
 } // namespace rr
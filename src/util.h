@@ -252,6 +252,18 @@ double monotonic_now_sec();
 
 bool running_under_rr();
 
+/**
+ * Raise our RLIMIT_NOFILE soft limit to the hard limit. rr holds perf
+ * counter fds for every tracee thread, so the usual 1024 isn't enough for
+ * heavily threaded tracees.
+ */
+void raise_fd_limit();
+
+/**
+ * Undo raise_fd_limit(), so tracees see the limit rr was started with.
+ */
+void restore_initial_fd_limit();
+
 } // namespace rr
 
 #endif /* RR_UTIL_H_ */